@@ -1,60 +1,212 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <execution>
+#include <functional>
 #include <mutex>
-#include <string>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// Lock for critical sections of a few dozen instructions, where a mutex would cost more than the work.
+class SpinLock {
+public:
+    void lock() {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            while (locked_.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock() {
+        locked_.store(false, std::memory_order_release);
+    }
 
-using namespace std::string_literals;
+private:
+    std::atomic<bool> locked_ = false;
+};
 
-template <typename Key, typename Value>
+// Hash map for updates from many threads. Keys are spread over shards by hash, every shard
+// on its own cache lines with its own spin lock. A shard keeps its entries in a dense array
+// and finds them through an open-addressing table with linear probing over entry indices;
+// entries keep their hashes, so probing compares keys only on a full hash match.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
 class ConcurrentMap {
 private:
-    struct Bucket {
-        std::mutex mutex;
-        std::map<Key, Value> map;
+    struct Entry {
+        size_t hash;
+        Key key;
+        Value value;
     };
 
-public:
-    static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys"s);
+    struct alignas(64) Shard {
+        SpinLock lock;
+        std::vector<Entry> entries;
+        std::vector<uint32_t> slots;
+    };
 
+public:
+    // Locks the shard of the key while it lives; the reference is valid until then.
     struct Access {
-        std::lock_guard<std::mutex> guard;
+        std::lock_guard<SpinLock> guard;
         Value& ref_to_value;
 
-        Access(const Key& key, Bucket& bucket)
-                : guard(bucket.mutex)
-                , ref_to_value(bucket.map[key]) {
+        Access(ConcurrentMap& map, const Key& key, size_t hash, Shard& shard)
+                : guard(shard.lock)
+                , ref_to_value(map.FindOrInsert(shard, key, hash)) {
         }
     };
 
-    explicit ConcurrentMap(size_t bucket_count)
-            : buckets_(bucket_count) {
+    explicit ConcurrentMap(size_t shard_count, Hash hasher = Hash(), KeyEqual key_equal = KeyEqual())
+            : shards_(std::max<size_t>(shard_count, 1))
+            , hasher_(std::move(hasher))
+            , key_equal_(std::move(key_equal)) {
     }
 
     Access operator[](const Key& key) {
-        auto& bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-        return {key, bucket};
+        const size_t hash = GetHash(key);
+        return {*this, key, hash, GetShard(hash)};
     }
 
-    std::map<Key, Value> BuildOrdinaryMap() {
-        std::map<Key, Value> result;
-        for (auto& [mutex, map] : buckets_) {
-            std::lock_guard g(mutex);
-            result.insert(map.begin(), map.end());
-        }
-        return result;
+    // Adds delta to the value of the key, inserting a value-initialized one first if needed;
+    // cheaper than operator[] for counters and sums.
+    void Add(const Key& key, Value delta) {
+        static_assert(std::is_arithmetic_v<Value>, "ConcurrentMap::Add needs an arithmetic value");
+        const size_t hash = GetHash(key);
+        Shard& shard = GetShard(hash);
+        std::lock_guard guard(shard.lock);
+        FindOrInsert(shard, key, hash) += delta;
     }
 
     void erase(const Key& key) {
-        size_t bucket_number = static_cast<uint64_t>(key) % buckets_.size();
-        buckets_[bucket_number].mutex.lock();
-        buckets_[bucket_number].map.erase(key);
-        buckets_[bucket_number].mutex.unlock();
+        const size_t hash = GetHash(key);
+        Shard& shard = GetShard(hash);
+        std::lock_guard guard(shard.lock);
+        if (!shard.slots.empty()) {
+            Erase(shard, FindSlot(shard, key, hash));
+        }
+    }
+
+    // Copies every entry, in no particular order. Shards are locked for the whole call,
+    // so the copy is a consistent snapshot, and are copied in parallel with a parallel policy.
+    template <typename ExecutionPolicy>
+    std::vector<std::pair<Key, Value>> Collect(const ExecutionPolicy& policy) {
+        for (Shard& shard : shards_) {
+            shard.lock.lock();
+        }
+        std::vector<size_t> offsets(shards_.size() + 1, 0);
+        std::transform_inclusive_scan(shards_.begin(), shards_.end(), offsets.begin() + 1, std::plus<>(), [](const Shard& shard) {
+            return shard.entries.size();
+        });
+        std::vector<std::pair<Key, Value>> result(offsets.back());
+        std::vector<size_t> shard_indices(shards_.size());
+        std::iota(shard_indices.begin(), shard_indices.end(), 0);
+        std::for_each(policy, shard_indices.begin(), shard_indices.end(), [this, &offsets, &result](size_t index) {
+            auto position = result.begin() + offsets[index];
+            for (const Entry& entry : shards_[index].entries) {
+                *position++ = {entry.key, entry.value};
+            }
+        });
+        for (Shard& shard : shards_) {
+            shard.lock.unlock();
+        }
+        return result;
+    }
 
+    std::vector<std::pair<Key, Value>> Collect() {
+        return Collect(std::execution::seq);
     }
 
 private:
-    std::vector<Bucket> buckets_;
-};
\ No newline at end of file
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    // Fibonacci hashing, so identity hashes of integers spread over shards and slots alike.
+    size_t GetHash(const Key& key) const {
+        return static_cast<size_t>(static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull);
+    }
+
+    Shard& GetShard(size_t hash) {
+        return shards_[(hash >> 32) % shards_.size()];
+    }
+
+    size_t FindSlot(const Shard& shard, const Key& key, size_t hash) const {
+        const size_t mask = shard.slots.size() - 1;
+        size_t slot = hash & mask;
+        while (shard.slots[slot] != EMPTY_SLOT) {
+            const Entry& entry = shard.entries[shard.slots[slot]];
+            if (entry.hash == hash && key_equal_(entry.key, key)) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    Value& FindOrInsert(Shard& shard, const Key& key, size_t hash);
+    static void Rehash(Shard& shard, size_t slot_count);
+    void Erase(Shard& shard, size_t slot);
+
+    std::vector<Shard> shards_;
+    Hash hasher_;
+    KeyEqual key_equal_;
+};
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+Value& ConcurrentMap<Key, Value, Hash, KeyEqual>::FindOrInsert(Shard& shard, const Key& key, size_t hash) {
+    // Keeps the table at most half full, so probe sequences stay short.
+    if (2 * (shard.entries.size() + 1) > shard.slots.size()) {
+        Rehash(shard, shard.slots.empty() ? 16 : 2 * shard.slots.size());
+    }
+    const size_t slot = FindSlot(shard, key, hash);
+    if (shard.slots[slot] == EMPTY_SLOT) {
+        shard.slots[slot] = static_cast<uint32_t>(shard.entries.size());
+        shard.entries.push_back({hash, key, Value()});
+    }
+    return shard.entries[shard.slots[slot]].value;
+}
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+void ConcurrentMap<Key, Value, Hash, KeyEqual>::Rehash(Shard& shard, size_t slot_count) {
+    shard.slots.assign(slot_count, EMPTY_SLOT);
+    const size_t mask = slot_count - 1;
+    for (size_t index = 0; index < shard.entries.size(); ++index) {
+        size_t slot = shard.entries[index].hash & mask;
+        while (shard.slots[slot] != EMPTY_SLOT) {
+            slot = (slot + 1) & mask;
+        }
+        shard.slots[slot] = static_cast<uint32_t>(index);
+    }
+}
+
+// Backward-shift deletion as in TermDictionary::Erase; the last entry then fills the hole
+// in the dense array, and its slot is repointed.
+template <typename Key, typename Value, typename Hash, typename KeyEqual>
+void ConcurrentMap<Key, Value, Hash, KeyEqual>::Erase(Shard& shard, size_t slot) {
+    const uint32_t index = shard.slots[slot];
+    if (index == EMPTY_SLOT) {
+        return;
+    }
+    const size_t mask = shard.slots.size() - 1;
+    for (size_t next = (slot + 1) & mask; shard.slots[next] != EMPTY_SLOT; next = (next + 1) & mask) {
+        const size_t home = shard.entries[shard.slots[next]].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            shard.slots[slot] = shard.slots[next];
+            slot = next;
+        }
+    }
+    shard.slots[slot] = EMPTY_SLOT;
+
+    const uint32_t last = static_cast<uint32_t>(shard.entries.size() - 1);
+    if (index != last) {
+        const Entry& moved = shard.entries[last];
+        shard.slots[FindSlot(shard, moved.key, moved.hash)] = index;
+        shard.entries[index] = std::move(shard.entries[last]);
+    }
+    shard.entries.pop_back();
+}
@@ -1,7 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
+#include <string_view>
 #include <vector>
 
+const double EPSILON = 1e-6;
+
 struct Document {
     Document() = default;
 
@@ -16,13 +20,35 @@ struct Document {
     int rating = 0;
 };
 
-enum class DocumentStatus {
+// One byte, so that the status column of an index is dense.
+enum class DocumentStatus : uint8_t {
     ACTUAL,
     IRRELEVANT,
     BANNED,
     REMOVED,
 };
 
+// What SearchServer does with a new document that has the same set of words as an indexed one.
+enum class DuplicatePolicy {
+    // Duplicates are indexed, and nothing is tracked.
+    ALLOW,
+    // Duplicates are indexed and reported.
+    REPORT,
+    // Adding a duplicate throws invalid_argument.
+    REJECT,
+};
+
+// Input of SearchServer::AddDocuments; text must stay alive until the call returns.
+struct NewDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// Ranking order of search results: relevance, then rating, then id so that ties are stable.
+bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
 std::ostream& operator<<(std::ostream& out, const Document& document);
 void PrintDocument(const Document& document);
 void PrintMatchDocumentResult(int document_id, const std::vector<std::string_view> words, DocumentStatus status);
@@ -0,0 +1,142 @@
+#include "document_filter.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t BLOCK_SIZE = 64;
+
+// Bit i of the result is set when element i of the block passes; blocks are BLOCK_SIZE elements.
+#if defined(__AVX2__)
+uint64_t MatchStatusBlock(const DocumentStatus* statuses, DocumentStatus status) {
+    const __m256i value = _mm256_set1_epi8(static_cast<char>(status));
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(statuses + i));
+        result |= uint64_t{static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, value)))} << i;
+    }
+    return result;
+}
+
+uint64_t MatchRangeBlock(const int* values, int min_value, int max_value) {
+    const __m256i low = _mm256_set1_epi32(min_value);
+    const __m256i high = _mm256_set1_epi32(max_value);
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 8) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        const __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(low, block), _mm256_cmpgt_epi32(block, high));
+        result |= uint64_t{~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(outside))) & 0xFFu} << i;
+    }
+    return result;
+}
+
+uint64_t MatchParityBlock(const int* values, int parity) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i expected = _mm256_set1_epi32(parity);
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 8) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        const __m256i matches = _mm256_cmpeq_epi32(_mm256_and_si256(block, one), expected);
+        result |= uint64_t{static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(matches)))} << i;
+    }
+    return result;
+}
+#elif defined(__SSE2__)
+uint64_t MatchStatusBlock(const DocumentStatus* statuses, DocumentStatus status) {
+    const __m128i value = _mm_set1_epi8(static_cast<char>(status));
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(statuses + i));
+        result |= uint64_t{static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, value)))} << i;
+    }
+    return result;
+}
+
+uint64_t MatchRangeBlock(const int* values, int min_value, int max_value) {
+    const __m128i low = _mm_set1_epi32(min_value);
+    const __m128i high = _mm_set1_epi32(max_value);
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 4) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(block, low), _mm_cmpgt_epi32(block, high));
+        result |= uint64_t{~static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(outside))) & 0xFu} << i;
+    }
+    return result;
+}
+
+uint64_t MatchParityBlock(const int* values, int parity) {
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i expected = _mm_set1_epi32(parity);
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 4) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        const __m128i matches = _mm_cmpeq_epi32(_mm_and_si128(block, one), expected);
+        result |= uint64_t{static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(matches)))} << i;
+    }
+    return result;
+}
+#else
+uint64_t MatchStatusBlock(const DocumentStatus* statuses, DocumentStatus status) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        result |= uint64_t{statuses[i] == status} << i;
+    }
+    return result;
+}
+
+uint64_t MatchRangeBlock(const int* values, int min_value, int max_value) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        result |= uint64_t{values[i] >= min_value && values[i] <= max_value} << i;
+    }
+    return result;
+}
+
+uint64_t MatchParityBlock(const int* values, int parity) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        result |= uint64_t{(values[i] & 1) == parity} << i;
+    }
+    return result;
+}
+#endif
+
+}  // namespace
+
+// Conditions that aren't set are skipped rather than evaluated as always true.
+void CompileDocumentFilter(const DocumentFilter& filter, const int* document_ids, const DocumentStatus* statuses, const int* ratings,
+                           uint32_t document_count, vector<uint64_t>& allowed) {
+    allowed.assign((document_count + BLOCK_SIZE - 1) / BLOCK_SIZE, 0);
+    const bool has_rating_range = filter.min_rating != INT_MIN || filter.max_rating != INT_MAX;
+    const bool has_id_range = filter.min_id != INT_MIN || filter.max_id != INT_MAX;
+    const int parity = filter.id_parity == DocumentFilter::Parity::ODD ? 1 : 0;
+    const uint32_t full_block_count = document_count / BLOCK_SIZE;
+    for (uint32_t block = 0; block < full_block_count; ++block) {
+        const uint32_t first = block * BLOCK_SIZE;
+        uint64_t bits = ~uint64_t{0};
+        if (filter.status) {
+            bits &= MatchStatusBlock(statuses + first, *filter.status);
+        }
+        if (has_rating_range && bits != 0) {
+            bits &= MatchRangeBlock(ratings + first, filter.min_rating, filter.max_rating);
+        }
+        if (has_id_range && bits != 0) {
+            bits &= MatchRangeBlock(document_ids + first, filter.min_id, filter.max_id);
+        }
+        if (filter.id_parity && bits != 0) {
+            bits &= MatchParityBlock(document_ids + first, parity);
+        }
+        allowed[block] = bits;
+    }
+    for (uint32_t ordinal = full_block_count * BLOCK_SIZE; ordinal < document_count; ++ordinal) {
+        if (filter(document_ids[ordinal], statuses[ordinal], ratings[ordinal])) {
+            allowed[ordinal / BLOCK_SIZE] |= uint64_t{1} << (ordinal % BLOCK_SIZE);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "document.h"
+
+// Declarative filter of FindTopDocuments: a document passes when it meets every condition set.
+// SearchServer evaluates it over its document columns into a bitmap before scoring, instead of
+// calling a predicate for every posting; elsewhere it works as an ordinary predicate.
+struct DocumentFilter {
+    enum class Parity {
+        EVEN,
+        ODD,
+    };
+
+    std::optional<DocumentStatus> status;
+    // Bounds are inclusive.
+    int min_rating = INT_MIN;
+    int max_rating = INT_MAX;
+    int min_id = INT_MIN;
+    int max_id = INT_MAX;
+    std::optional<Parity> id_parity;
+
+    bool operator()(int document_id, DocumentStatus document_status, int rating) const {
+        return (!status || document_status == *status)
+               && rating >= min_rating && rating <= max_rating
+               && document_id >= min_id && document_id <= max_id
+               && (!id_parity || (document_id & 1) == (*id_parity == Parity::ODD ? 1 : 0));
+    }
+
+    // Status filters are the common case, whose bitmaps SearchServer keeps between queries.
+    bool HasStatusOnly() const {
+        return status && min_rating == INT_MIN && max_rating == INT_MAX && min_id == INT_MIN && max_id == INT_MAX && !id_parity;
+    }
+};
+
+// Replaces allowed with a bitmap of the document_count documents, bit i set when the document
+// in position i of the columns passes the filter. Conditions are checked 64 documents at a time,
+// with AVX2 or SSE2 where available.
+void CompileDocumentFilter(const DocumentFilter& filter, const int* document_ids, const DocumentStatus* statuses, const int* ratings,
+                           uint32_t document_count, std::vector<uint64_t>& allowed);
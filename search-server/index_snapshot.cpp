@@ -0,0 +1,430 @@
+#include "index_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum Section {
+    STOP_WORD_OFFSETS,
+    STOP_WORD_CHARS,
+    TERM_SLOTS,
+    TERMS,
+    TERM_CHARS,
+    BLOCKS,
+    DELTAS,
+    COUNTS,
+    DOCUMENT_IDS,
+    RATINGS,
+    STATUSES,
+    INV_WORD_COUNTS,
+    TEXT_OFFSETS,
+    TEXT_CHARS,
+    ID_INDEX,
+    SECTION_COUNT,
+};
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint64_t stop_word_count;
+    uint64_t term_count;
+    uint64_t term_slot_count;
+    uint64_t document_count;
+    SectionEntry sections[SECTION_COUNT];
+};
+
+struct TermEntry {
+    uint64_t hash;
+    uint64_t word_offset;
+    uint64_t first_block;
+    uint64_t delta_offset;
+    uint64_t count_offset;
+    uint64_t posting_count;
+    double max_term_freq;
+    uint32_t word_length;
+    uint32_t block_count;
+};
+
+static_assert(sizeof(PostingBlock) == 20, "PostingBlock is stored in snapshots as is");
+static_assert(sizeof(DocumentStatus) == sizeof(uint8_t), "DocumentStatus is stored in snapshots as is");
+static_assert(sizeof(int) == sizeof(int32_t), "document ids and ratings are stored as int32_t");
+
+// FNV-1a, which unlike std::hash gives the same value in every build reading the file.
+uint64_t HashWord(string_view word) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char c : word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+const Header& GetHeader(const MappedFile& file) {
+    return *reinterpret_cast<const Header*>(file.data());
+}
+
+template <typename T>
+void Append(vector<char>& output, const T* values, size_t count) {
+    const char* bytes = reinterpret_cast<const char*>(values);
+    output.insert(output.end(), bytes, bytes + count * sizeof(T));
+}
+
+void CheckHeader(const MappedFile& file) {
+    using namespace std::string_literals;
+    if (file.size() < sizeof(Header)) {
+        throw invalid_argument("Snapshot file is truncated"s);
+    }
+    const Header& header = GetHeader(file);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw invalid_argument("File is not an index snapshot"s);
+    }
+    if (header.version != IndexSnapshot::VERSION || header.byte_order != BYTE_ORDER_MARK) {
+        throw invalid_argument("Snapshot version or byte order is not supported"s);
+    }
+    if (header.file_size != file.size()) {
+        throw invalid_argument("Snapshot file is truncated"s);
+    }
+    if (header.term_slot_count == 0 || (header.term_slot_count & (header.term_slot_count - 1)) != 0
+            || header.term_slot_count <= header.term_count) {
+        throw invalid_argument("Snapshot term table is invalid"s);
+    }
+
+    const uint64_t document_count = header.document_count;
+    const uint64_t expected_sizes[SECTION_COUNT] = {
+        (header.stop_word_count + 1) * sizeof(uint64_t),
+        header.sections[STOP_WORD_CHARS].size,
+        header.term_slot_count * sizeof(uint32_t),
+        header.term_count * sizeof(TermEntry),
+        header.sections[TERM_CHARS].size,
+        header.sections[BLOCKS].size - header.sections[BLOCKS].size % sizeof(PostingBlock),
+        header.sections[DELTAS].size,
+        header.sections[COUNTS].size,
+        document_count * sizeof(int32_t),
+        document_count * sizeof(int32_t),
+        document_count * sizeof(DocumentStatus),
+        document_count * sizeof(double),
+        (document_count + 1) * sizeof(uint64_t),
+        header.sections[TEXT_CHARS].size,
+        document_count * sizeof(IndexSnapshot::IdEntry),
+    };
+    for (size_t section = 0; section < SECTION_COUNT; ++section) {
+        const SectionEntry& entry = header.sections[section];
+        if (entry.size != expected_sizes[section] || entry.offset % 8 != 0
+                || entry.offset < sizeof(Header) || entry.offset > file.size() || entry.size > file.size() - entry.offset) {
+            throw invalid_argument("Snapshot section is invalid"s);
+        }
+    }
+}
+
+// Writes the file aside and renames it over path: a file that is mapped somewhere
+// must never change under the mapping.
+void WriteFile(const string& path, const vector<string_view>& pieces) {
+    using namespace std::string_literals;
+    const string temporary_path = path + ".tmp"s;
+    {
+        ofstream output(temporary_path, ios::binary | ios::trunc);
+        for (const string_view piece : pieces) {
+            output.write(piece.data(), static_cast<streamsize>(piece.size()));
+        }
+        if (!output) {
+            throw runtime_error("Can't write snapshot file "s + temporary_path);
+        }
+    }
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw runtime_error("Can't write snapshot file "s + path);
+    }
+}
+
+} // namespace
+
+#ifdef _WIN32
+MappedFile::MappedFile(const string& path) {
+    using namespace std::string_literals;
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Can't open snapshot file "s + path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) {
+        CloseHandle(file_);
+        throw runtime_error("Can't open snapshot file "s + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data_ = mapping_ != nullptr ? static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (data_ == nullptr) {
+        if (mapping_ != nullptr) {
+            CloseHandle(mapping_);
+        }
+        CloseHandle(file_);
+        throw runtime_error("Can't map snapshot file "s + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+    }
+    CloseHandle(file_);
+}
+#else
+MappedFile::MappedFile(const string& path) {
+    using namespace std::string_literals;
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Can't open snapshot file "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw runtime_error("Can't open snapshot file "s + path);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Can't map snapshot file "s + path);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping keeps the file referenced.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+#endif
+
+const char* MappedFile::data() const {
+    return data_;
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
+
+void WriteIndexSnapshot(const string& path, const vector<string_view>& stop_words,
+                        const vector<pair<string_view, PostingListView>>& terms,
+                        const vector<SnapshotDocument>& documents) {
+    using namespace std::string_literals;
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = IndexSnapshot::VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.stop_word_count = stop_words.size();
+    header.term_count = terms.size();
+    header.term_slot_count = 1;
+    while (header.term_slot_count < 2 * terms.size() + 1) {
+        header.term_slot_count *= 2;
+    }
+    header.document_count = documents.size();
+
+    vector<char> sections[SECTION_COUNT];
+
+    uint64_t offset = 0;
+    for (const string_view word : stop_words) {
+        Append(sections[STOP_WORD_OFFSETS], &offset, 1);
+        Append(sections[STOP_WORD_CHARS], word.data(), word.size());
+        offset += word.size();
+    }
+    Append(sections[STOP_WORD_OFFSETS], &offset, 1);
+
+    vector<uint32_t> slots(header.term_slot_count, 0);
+    const uint64_t slot_mask = header.term_slot_count - 1;
+    for (size_t term_index = 0; term_index < terms.size(); ++term_index) {
+        const auto& [word, postings] = terms[term_index];
+        TermEntry entry{};
+        entry.hash = HashWord(word);
+        entry.word_offset = sections[TERM_CHARS].size();
+        entry.word_length = static_cast<uint32_t>(word.size());
+        entry.first_block = sections[BLOCKS].size() / sizeof(PostingBlock);
+        entry.block_count = static_cast<uint32_t>(postings.GetBlockCount());
+        entry.delta_offset = sections[DELTAS].size();
+        entry.count_offset = sections[COUNTS].size();
+        entry.posting_count = postings.size();
+        entry.max_term_freq = postings.GetMaxTermFreq();
+        Append(sections[TERMS], &entry, 1);
+        Append(sections[TERM_CHARS], word.data(), word.size());
+        Append(sections[BLOCKS], postings.GetBlocks(), postings.GetBlockCount());
+        Append(sections[DELTAS], postings.GetDeltas(), postings.GetDeltaBytes());
+        Append(sections[COUNTS], postings.GetCounts(), postings.GetCountBytes());
+
+        uint64_t slot = entry.hash & slot_mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & slot_mask;
+        }
+        slots[slot] = static_cast<uint32_t>(term_index + 1);
+    }
+    Append(sections[TERM_SLOTS], slots.data(), slots.size());
+
+    vector<IndexSnapshot::IdEntry> id_index;
+    id_index.reserve(documents.size());
+    offset = 0;
+    for (size_t ordinal = 0; ordinal < documents.size(); ++ordinal) {
+        const SnapshotDocument& document = documents[ordinal];
+        Append(sections[DOCUMENT_IDS], &document.id, 1);
+        Append(sections[RATINGS], &document.rating, 1);
+        Append(sections[STATUSES], &document.status, 1);
+        Append(sections[INV_WORD_COUNTS], &document.inv_word_count, 1);
+        Append(sections[TEXT_OFFSETS], &offset, 1);
+        Append(sections[TEXT_CHARS], document.text.data(), document.text.size());
+        offset += document.text.size();
+        id_index.push_back({ document.id, static_cast<uint32_t>(ordinal) });
+    }
+    Append(sections[TEXT_OFFSETS], &offset, 1);
+    sort(id_index.begin(), id_index.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.document_id < rhs.document_id;
+    });
+    Append(sections[ID_INDEX], id_index.data(), id_index.size());
+
+    uint64_t file_size = sizeof(Header);
+    for (size_t section = 0; section < SECTION_COUNT; ++section) {
+        file_size = (file_size + 7) / 8 * 8;
+        header.sections[section] = { file_size, sections[section].size() };
+        file_size += sections[section].size();
+    }
+    header.file_size = file_size;
+
+    vector<string_view> pieces = { string_view(reinterpret_cast<const char*>(&header), sizeof(header)) };
+    uint64_t written = sizeof(Header);
+    static const char padding[8] = {};
+    for (size_t section = 0; section < SECTION_COUNT; ++section) {
+        pieces.push_back(string_view(padding, header.sections[section].offset - written));
+        pieces.push_back(string_view(sections[section].data(), sections[section].size()));
+        written = header.sections[section].offset + sections[section].size();
+    }
+    WriteFile(path, pieces);
+}
+
+IndexSnapshot::IndexSnapshot(const string& path)
+        : file_(path) {
+    CheckHeader(file_);
+}
+
+template <typename T>
+const T* IndexSnapshot::GetSection(size_t section) const {
+    return reinterpret_cast<const T*>(file_.data() + GetHeader(file_).sections[section].offset);
+}
+
+vector<string_view> IndexSnapshot::GetStopWords() const {
+    const uint64_t* offsets = GetSection<uint64_t>(STOP_WORD_OFFSETS);
+    const char* chars = GetSection<char>(STOP_WORD_CHARS);
+    vector<string_view> stop_words;
+    for (uint64_t i = 0; i < GetHeader(file_).stop_word_count; ++i) {
+        stop_words.push_back(string_view(chars + offsets[i], offsets[i + 1] - offsets[i]));
+    }
+    return stop_words;
+}
+
+optional<uint32_t> IndexSnapshot::FindTerm(string_view word) const {
+    const uint32_t* slots = GetSection<uint32_t>(TERM_SLOTS);
+    const TermEntry* terms = GetSection<TermEntry>(TERMS);
+    const char* term_chars = GetSection<char>(TERM_CHARS);
+    const uint64_t hash = HashWord(word);
+    const uint64_t slot_mask = GetHeader(file_).term_slot_count - 1;
+    for (uint64_t slot = hash & slot_mask; slots[slot] != 0; slot = (slot + 1) & slot_mask) {
+        const TermEntry& term = terms[slots[slot] - 1];
+        if (term.hash == hash && string_view(term_chars + term.word_offset, term.word_length) == word) {
+            return slots[slot] - 1;
+        }
+    }
+    return nullopt;
+}
+
+string_view IndexSnapshot::GetTermWord(uint32_t term) const {
+    const TermEntry& entry = GetSection<TermEntry>(TERMS)[term];
+    return string_view(GetSection<char>(TERM_CHARS) + entry.word_offset, entry.word_length);
+}
+
+PostingListView IndexSnapshot::GetPostings(uint32_t term) const {
+    const TermEntry& entry = GetSection<TermEntry>(TERMS)[term];
+    return PostingListView(GetSection<PostingBlock>(BLOCKS) + entry.first_block, entry.block_count,
+                           GetSection<uint8_t>(DELTAS) + entry.delta_offset, GetSection<uint8_t>(COUNTS) + entry.count_offset,
+                           entry.posting_count, entry.max_term_freq);
+}
+
+uint32_t IndexSnapshot::GetDocumentCount() const {
+    return static_cast<uint32_t>(GetHeader(file_).document_count);
+}
+
+const int* IndexSnapshot::GetDocumentIds() const {
+    return GetSection<int>(DOCUMENT_IDS);
+}
+
+const int* IndexSnapshot::GetRatings() const {
+    return GetSection<int>(RATINGS);
+}
+
+const DocumentStatus* IndexSnapshot::GetStatuses() const {
+    return GetSection<DocumentStatus>(STATUSES);
+}
+
+const double* IndexSnapshot::GetInvWordCounts() const {
+    return GetSection<double>(INV_WORD_COUNTS);
+}
+
+string_view IndexSnapshot::GetDocumentText(uint32_t ordinal) const {
+    const uint64_t* offsets = GetSection<uint64_t>(TEXT_OFFSETS);
+    return string_view(GetSection<char>(TEXT_CHARS) + offsets[ordinal], offsets[ordinal + 1] - offsets[ordinal]);
+}
+
+optional<uint32_t> IndexSnapshot::FindDocument(int document_id) const {
+    const IdEntry* first = GetIdIndex();
+    const IdEntry* last = first + GetDocumentCount();
+    const IdEntry* it = lower_bound(first, last, document_id, [](const IdEntry& entry, int id) {
+        return entry.document_id < id;
+    });
+    if (it == last || it->document_id != document_id) {
+        return nullopt;
+    }
+    return it->ordinal;
+}
+
+const IndexSnapshot::IdEntry* IndexSnapshot::GetIdIndex() const {
+    return GetSection<IdEntry>(ID_INDEX);
+}
+
+string_view IndexSnapshot::GetData() const {
+    return string_view(file_.data(), file_.size());
+}
+
+void IndexSnapshot::Save(const string& path) const {
+    WriteFile(path, { GetData() });
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "posting_list.h"
+
+// Read-only mapping of a whole file: mmap on POSIX, a file mapping view on Windows.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    const char* data() const;
+    size_t size() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+// A document as stored in a snapshot, in ordinal order.
+struct SnapshotDocument {
+    int id;
+    int rating;
+    DocumentStatus status;
+    double inv_word_count;
+    std::string_view text;
+};
+
+// Writes a snapshot file. Document ordinals must be dense: the postings refer to
+// positions in documents. The file is written aside and renamed over path, so processes
+// that have the previous version mapped keep reading it.
+void WriteIndexSnapshot(const std::string& path, const std::vector<std::string_view>& stop_words,
+                        const std::vector<std::pair<std::string_view, PostingListView>>& terms,
+                        const std::vector<SnapshotDocument>& documents);
+
+// Versioned binary index written by WriteIndexSnapshot and used in place from a read-only mapping.
+// Sections are host-endian arrays aligned to 8 bytes: stop words, an open-addressing table
+// of terms, posting blocks with their packed deltas and counts exactly as in PostingList,
+// per-ordinal document columns, documents sorted by id and document text.
+// Opening a snapshot only checks the header, so it takes the same time for any corpus size,
+// and processes mapping the same file share its pages in the page cache.
+class IndexSnapshot {
+public:
+    // Version 2 stores statuses as bytes, version 3 a term frequency bound per posting block.
+    static constexpr uint32_t VERSION = 3;
+
+    struct IdEntry {
+        int32_t document_id;
+        uint32_t ordinal;
+    };
+
+    explicit IndexSnapshot(const std::string& path);
+
+    std::vector<std::string_view> GetStopWords() const;
+
+    // Terms are numbered in the order of the table entries.
+    std::optional<uint32_t> FindTerm(std::string_view word) const;
+    std::string_view GetTermWord(uint32_t term) const;
+    PostingListView GetPostings(uint32_t term) const;
+
+    uint32_t GetDocumentCount() const;
+    const int* GetDocumentIds() const;
+    const int* GetRatings() const;
+    const DocumentStatus* GetStatuses() const;
+    const double* GetInvWordCounts() const;
+    std::string_view GetDocumentText(uint32_t ordinal) const;
+
+    std::optional<uint32_t> FindDocument(int document_id) const;
+    // Documents ordered by id.
+    const IdEntry* GetIdIndex() const;
+
+    // The whole file.
+    std::string_view GetData() const;
+    void Save(const std::string& path) const;
+
+private:
+    template <typename T>
+    const T* GetSection(size_t section) const;
+
+    MappedFile file_;
+};
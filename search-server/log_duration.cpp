@@ -1,16 +1,16 @@
-#include "log_duration"
+#include "log_duration.h"
 
-    LogDuration(const std::string& id, std::ostream& out = std::cerr)
-        : id_(id),
-        out_(out)
-    {
-    }
+LogDuration::LogDuration(std::string_view id, std::ostream& out)
+    : id_(id),
+    out_(out)
+{
+}
 
-    ~LogDuration::LogDuration() {
-        using namespace std::chrono;
-        using namespace std::literals;
+LogDuration::~LogDuration() {
+    using namespace std::chrono;
+    using namespace std::literals;
 
-        const auto end_time = Clock::now();
-        const auto dur = end_time - start_time_;
-        out_ << "Operation time: "s << duration_cast<milliseconds>(dur).count() << " ms"s << std::endl;
-    }
\ No newline at end of file
+    const auto end_time = Clock::now();
+    const auto dur = end_time - start_time_;
+    out_ << id_ << ": "s << duration_cast<milliseconds>(dur).count() << " ms"s << std::endl;
+}
@@ -1,16 +1,66 @@
+#include "concurrent_map.h"
 #include "process_queries.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
 #include "search_server.h"
+#include "segmented_search_server.h"
 
 #include "log_duration.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <execution>
+#include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
 #include <random>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
+// Stops the benchmark when a strategy disagrees with the reference one.
+#define CHECK(condition)                                                                        \
+    do {                                                                                        \
+        if (!(condition)) {                                                                     \
+            cerr << __FILE__ << ':' << __LINE__ << ": check failed: "s << #condition << endl; \
+            abort();                                                                            \
+        }                                                                                       \
+    } while (false)
+
+atomic<size_t> allocated_bytes = 0;
+atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocated_bytes += size;
+    ++allocation_count;
+    if (void* pointer = malloc(size)) {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+// The default array forms end up in the ones above, but the sized delete is called directly.
+// It is kept out of line: once inlined, free of a pointer from operator new looks like
+// a mismatch to the compiler.
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
 string GenerateWord(mt19937& generator, int max_length) {
     const int length = uniform_int_distribution(1, max_length)(generator);
     string word;
@@ -54,8 +104,8 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     return queries;
 }
 
-template <typename ExecutionPolicy>
-void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
+template <typename Server, typename ExecutionPolicy>
+void Test(string_view mark, const Server& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
     LOG_DURATION(mark);
     double total_relevance = 0;
     for (const string_view query : queries) {
@@ -68,6 +118,1167 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
 
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 
+bool AreSameDocuments(const vector<Document>& lhs, const vector<Document>& rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Document& lhs, const Document& rhs) {
+        return lhs.id == rhs.id && lhs.relevance == rhs.relevance && lhs.rating == rhs.rating;
+    });
+}
+
+// WAND must find the same documents with the same relevance as exhaustive scoring.
+void CheckWand(const SearchServer& search_server, const vector<string>& queries) {
+    for (const size_t max_document_count : {size_t{1}, size_t{5}, size_t{20}, size_t{100}}) {
+        for (const string& query : queries) {
+            CHECK(AreSameDocuments(search_server.FindTopDocuments(pruning::wand, query, DocumentStatus::ACTUAL, max_document_count),
+                                   search_server.FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL, max_document_count)));
+        }
+    }
+}
+
+void TestWand(const SearchServer& search_server, const vector<string>& queries) {
+    CheckWand(search_server, queries);
+    pruning::Stats stats;
+    Test("wand"sv, search_server, queries, pruning::wand_policy{&stats});
+    cout << "postings scored: "s << stats.postings_scored << ", skipped: "s << stats.postings_skipped << endl;
+}
+
+// Words of the documents follow Zipf's law, and every query mixes a few of the most frequent
+// words with a few rare ones. Once the top is full, the frequent words can't outrank it on their
+// own, so WAND looks them up only for the documents of the rare ones, while exhaustive scoring
+// walks their long posting lists.
+void TestWandSkewedWords(mt19937& generator) {
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    vector<double> word_weights(dictionary.size());
+    for (size_t i = 0; i < word_weights.size(); ++i) {
+        word_weights[i] = 1.0 / (i + 1);
+    }
+    discrete_distribution<size_t> zipf(word_weights.begin(), word_weights.end());
+    SearchServer search_server(""s);
+    for (int id = 0; id < 50'000; ++id) {
+        string text;
+        for (int i = uniform_int_distribution(20, 200)(generator); i > 0; --i) {
+            if (!text.empty()) {
+                text.push_back(' ');
+            }
+            text += dictionary[zipf(generator)];
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    const auto pick_words = [&generator, &dictionary](string& query, size_t first_rank, size_t last_rank) {
+        for (int i = uniform_int_distribution(1, 3)(generator); i > 0; --i) {
+            if (!query.empty()) {
+                query.push_back(' ');
+            }
+            query += dictionary[uniform_int_distribution(first_rank, last_rank)(generator)];
+        }
+    };
+    vector<string> queries(300);
+    for (string& query : queries) {
+        pick_words(query, 0, 100);
+        pick_words(query, 500, 5000);
+    }
+
+    CheckWand(search_server, queries);
+    Test("skewed words, seq"sv, search_server, queries, execution::seq);
+    pruning::Stats stats;
+    Test("skewed words, wand"sv, search_server, queries, pruning::wand_policy{&stats});
+    cout << "postings scored: "s << stats.postings_scored << ", skipped: "s << stats.postings_skipped << endl;
+}
+
+// Queries whose predicate reads the status and rating columns, and iteration over the ids.
+void TestDocumentMetadata(const SearchServer& search_server, const vector<string>& queries) {
+    {
+        LOG_DURATION("FindTopDocuments with a status and rating predicate"s);
+        double total_relevance = 0;
+        for (const string_view query : queries) {
+            for (const auto& document : search_server.FindTopDocuments(query, [](int document_id, DocumentStatus status, int rating) {
+                     return status == DocumentStatus::ACTUAL && rating > 1 && document_id % 2 == 0;
+                 })) {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+    {
+        LOG_DURATION("100 passes over the document ids"s);
+        int64_t id_sum = 0;
+        for (int pass = 0; pass < 100; ++pass) {
+            for (const int document_id : search_server) {
+                id_sum += document_id;
+            }
+        }
+        cout << id_sum << endl;
+    }
+}
+
+// The same filters as a lambda called per posting and as a DocumentFilter compiled into a bitmap.
+void TestDocumentFilter(const SearchServer& search_server, const vector<string>& queries) {
+    const auto run = [&search_server, &queries](string_view mark, const auto& filter) {
+        LOG_DURATION(mark);
+        double total_relevance = 0;
+        for (int pass = 0; pass < 10; ++pass) {
+            for (const string_view query : queries) {
+                for (const auto& document : search_server.FindTopDocuments(query, filter)) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        cout << total_relevance << endl;
+    };
+    run("status lambda"sv, [](int, DocumentStatus status, int) {
+        return status == DocumentStatus::ACTUAL;
+    });
+    DocumentFilter status_filter;
+    status_filter.status = DocumentStatus::ACTUAL;
+    run("status DocumentFilter (cached bitmap)"sv, status_filter);
+    run("status, rating and id lambda"sv, [](int document_id, DocumentStatus status, int rating) {
+        return status == DocumentStatus::ACTUAL && rating >= 2 && document_id % 2 == 0;
+    });
+    DocumentFilter filter;
+    filter.status = DocumentStatus::ACTUAL;
+    filter.min_rating = 2;
+    filter.id_parity = DocumentFilter::Parity::EVEN;
+    run("status, rating and id DocumentFilter"sv, filter);
+}
+
+// A compiled DocumentFilter must find the same documents as the filter called as a predicate.
+template <typename Server>
+void CheckSameFilterResults(const Server& search_server, const vector<DocumentFilter>& filters, const vector<string>& queries) {
+    for (const DocumentFilter& filter : filters) {
+        const auto predicate = [&filter](int document_id, DocumentStatus status, int rating) {
+            return filter(document_id, status, rating);
+        };
+        for (const string& query : queries) {
+            const auto found = search_server.FindTopDocuments(query, filter, 20);
+            CHECK(AreSameDocuments(found, search_server.FindTopDocuments(query, predicate, 20)));
+            CHECK(AreSameDocuments(search_server.FindTopDocuments(execution::par, query, filter, 20), found));
+        }
+    }
+}
+
+// Checks status, rating, id range and parity filters and their combination, on a SearchServer
+// before and after removals and compaction, and on a segmented index with removed documents.
+void CheckDocumentFilter(const string& stop_words, const vector<string>& texts, const vector<string>& queries) {
+    vector<NewDocument> documents;
+    for (size_t i = 0; i < 4'000; ++i) {
+        documents.push_back({ static_cast<int>(i), texts[i], static_cast<DocumentStatus>(i % 4), { static_cast<int>(i % 11) - 5 } });
+    }
+    vector<int> removed_ids;
+    for (size_t i = 0; i < documents.size(); i += 3) {
+        removed_ids.push_back(documents[i].id);
+    }
+    vector<DocumentFilter> filters(7);
+    filters[0].status = DocumentStatus::ACTUAL;
+    filters[1].status = DocumentStatus::BANNED;
+    filters[2].min_rating = -2;
+    filters[2].max_rating = 3;
+    filters[3].id_parity = DocumentFilter::Parity::ODD;
+    filters[4].min_id = 500;
+    filters[4].max_id = 2'500;
+    filters[5].status = DocumentStatus::ACTUAL;
+    filters[5].min_rating = 0;
+    filters[5].id_parity = DocumentFilter::Parity::EVEN;
+    const vector<string> checked_queries(queries.begin(), queries.begin() + 20);
+
+    SearchServer search_server(stop_words);
+    search_server.AddDocuments(execution::par, documents);
+    CheckSameFilterResults(search_server, filters, checked_queries);
+    search_server.RemoveDocuments(execution::par, removed_ids);
+    CheckSameFilterResults(search_server, filters, checked_queries);
+    search_server.CompactDeletedDocuments();
+    CheckSameFilterResults(search_server, filters, checked_queries);
+
+    SegmentedSearchServer segmented(stop_words);
+    for (const NewDocument& document : documents) {
+        segmented.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    segmented.Flush();
+    CheckSameFilterResults(segmented, filters, checked_queries);
+    for (const int document_id : removed_ids) {
+        segmented.RemoveDocument(document_id);
+    }
+    segmented.Flush();
+    CheckSameFilterResults(segmented, filters, checked_queries);
+    for (const DocumentFilter& filter : filters) {
+        for (const string& query : checked_queries) {
+            CHECK(AreSameDocuments(segmented.FindTopDocuments(query, filter, 20), search_server.FindTopDocuments(query, filter, 20)));
+        }
+    }
+}
+
+// Heap allocations of a query after warm-up; only the returned vector is expected to remain.
+void TestQueryAllocations(const SearchServer& search_server, const vector<string>& queries) {
+    for (const string& query : queries) {
+        search_server.FindTopDocuments(query);
+        search_server.MatchDocument(query, 0);
+    }
+    size_t start_allocation_count = allocation_count;
+    for (const string& query : queries) {
+        search_server.FindTopDocuments(query);
+    }
+    cout << "allocations per FindTopDocuments: "s << (allocation_count - start_allocation_count) * 1.0 / queries.size() << endl;
+    start_allocation_count = allocation_count;
+    for (const string& query : queries) {
+        search_server.MatchDocument(query, 0);
+    }
+    cout << "allocations per MatchDocument: "s << (allocation_count - start_allocation_count) * 1.0 / queries.size() << endl;
+}
+
+// Tokenizes the whole corpus as one text: with find(' ') followed by a check of every word
+// for control characters, and with SplitIntoValidWordsView, which does both in one pass.
+void TestTokenizer(const vector<string>& documents) {
+    string text;
+    for (const string& document : documents) {
+        text += document;
+        text.push_back(' ');
+    }
+    const int pass_count = 50;
+    const double gigabytes = text.size() * pass_count / 1e9;
+    vector<string_view> words;
+    size_t word_count = 0;
+    {
+        const auto start_time = chrono::steady_clock::now();
+        for (int pass = 0; pass < pass_count; ++pass) {
+            words.clear();
+            string_view rest = text;
+            while (true) {
+                const size_t space = rest.find(' ');
+                words.push_back(rest.substr(0, space));
+                if (space == rest.npos) {
+                    break;
+                }
+                rest.remove_prefix(space + 1);
+            }
+            for (const string_view word : words) {
+                word_count += none_of(word.begin(), word.end(), [](char c) {
+                    return c >= '\0' && c < ' ';
+                });
+            }
+        }
+        const chrono::duration<double> seconds = chrono::steady_clock::now() - start_time;
+        cout << "find(' ') and word check: "s << gigabytes / seconds.count() << " GB/s"s << endl;
+    }
+    {
+        const auto start_time = chrono::steady_clock::now();
+        for (int pass = 0; pass < pass_count; ++pass) {
+            word_count += SplitIntoValidWordsView(text, words) ? words.size() : 0;
+        }
+        const chrono::duration<double> seconds = chrono::steady_clock::now() - start_time;
+        cout << "SplitIntoValidWordsView: "s << gigabytes / seconds.count() << " GB/s"s << endl;
+    }
+    cout << word_count << endl;
+}
+
+// Stop-word lookups of every word of the documents, with a stop list of a few hundred words.
+void TestStopWords(const vector<string>& dictionary, const vector<string>& documents) {
+    const set<string, less<>> stop_words(dictionary.begin(), dictionary.begin() + 300);
+    const StopWordSet stop_word_set(stop_words);
+    vector<string_view> words;
+    size_t word_count = 0;
+    for (const string& document : documents) {
+        word_count += SplitIntoWordsView(document).size();
+    }
+    size_t stop_word_count = 0;
+    size_t kept_word_count = 0;
+    {
+        LOG_DURATION("std::set stop words"s);
+        for (const string& document : documents) {
+            SplitIntoValidWordsView(document, words);
+            for (const string_view word : words) {
+                stop_word_count += !word.empty() && stop_words.count(word) > 0;
+            }
+        }
+    }
+    {
+        LOG_DURATION("StopWordSet in the tokenizer pass"s);
+        for (const string& document : documents) {
+            SplitIntoValidWordsView(document, words, stop_word_set);
+            kept_word_count += words.size();
+        }
+    }
+    cout << word_count << " words, "s << stop_word_count << " stop words, "s << kept_word_count << " kept"s << endl;
+}
+
+// Compares the compressed PostingList with a std::map<int, double> holding the same postings:
+// a word occurring in about every 8th document of a 8M-document corpus.
+void TestPostingLayout(mt19937& generator) {
+    const int posting_count = 1'000'000;
+    const int pass_count = 20;
+    vector<pair<uint32_t, uint32_t>> postings;
+    postings.reserve(posting_count);
+    uint32_t document_ordinal = 0;
+    for (int i = 0; i < posting_count; ++i) {
+        document_ordinal += uniform_int_distribution<uint32_t>(1, 15)(generator);
+        postings.push_back({document_ordinal, uniform_int_distribution<uint32_t>(1, 3)(generator)});
+    }
+
+    const size_t tree_start_bytes = allocated_bytes;
+    map<int, double> tree;
+    for (const auto& [ordinal, count] : postings) {
+        tree.emplace(ordinal, count * 0.01);
+    }
+    const size_t tree_bytes = allocated_bytes - tree_start_bytes;
+
+    PostingList list;
+    for (const auto& [ordinal, count] : postings) {
+        list.Add(ordinal, count, count * 0.01);
+    }
+    cout << "bytes per posting: std::map "s << tree_bytes * 1.0 / posting_count
+         << ", PostingList "s << list.GetMemoryUsage() * 1.0 / posting_count << endl;
+
+    uint64_t checksum = 0;
+    {
+        LOG_DURATION("decode 20M postings from std::map"s);
+        for (int pass = 0; pass < pass_count; ++pass) {
+            for (const auto [ordinal, term_freq] : tree) {
+                checksum += ordinal + static_cast<uint32_t>(term_freq * 100);
+            }
+        }
+    }
+    {
+        LOG_DURATION("decode 20M postings from PostingList"s);
+        for (int pass = 0; pass < pass_count; ++pass) {
+            for (auto cursor = list.GetCursor(); !cursor.AtEnd(); cursor.Next()) {
+                checksum += cursor.GetOrdinal() + cursor.GetCount();
+            }
+        }
+    }
+    cout << checksum << endl;
+}
+
+template <typename ExecutionPolicy>
+void TestBulkIndexing(string_view mark, const string& stop_words, const vector<NewDocument>& documents, ExecutionPolicy&& policy) {
+    const auto start_time = chrono::steady_clock::now();
+    SearchServer search_server(stop_words);
+    search_server.AddDocuments(policy, documents);
+    const chrono::duration<double> seconds = chrono::steady_clock::now() - start_time;
+    cout << mark << ": "s << documents.size() / seconds.count() << " docs/sec with "s << THREADS_COUNT << " cores"s << endl;
+}
+
+// Contents of an index read through the public interface: the postings of every word as
+// (document id, term frequency), the term ids of every document, which follow the order words
+// were first indexed in, and the status and rating of every document.
+struct IndexContents {
+    vector<int> document_ids;
+    map<string, vector<pair<int, double>>, less<>> postings;
+    vector<vector<uint32_t>> document_terms;
+    map<int, pair<DocumentStatus, int>> columns;
+    uint64_t index_version = 0;
+};
+
+bool operator==(const IndexContents& lhs, const IndexContents& rhs) {
+    return lhs.document_ids == rhs.document_ids && lhs.postings == rhs.postings && lhs.document_terms == rhs.document_terms
+           && lhs.columns == rhs.columns && lhs.index_version == rhs.index_version;
+}
+
+// all_words_query has to match every document, so that the predicate sees all of them.
+IndexContents GetIndexContents(const SearchServer& search_server, const string& all_words_query) {
+    IndexContents contents;
+    for (const int document_id : search_server) {
+        contents.document_ids.push_back(document_id);
+        for (const auto& [word, term_freq] : search_server.GetWordFrequencies(document_id)) {
+            contents.postings[string(word)].push_back({ document_id, term_freq });
+        }
+        search_server.GetDocumentTerms(document_id, contents.document_terms.emplace_back());
+    }
+    search_server.FindTopDocuments(all_words_query, [&contents](int document_id, DocumentStatus status, int rating) {
+        contents.columns[document_id] = { status, rating };
+        return false;
+    });
+    contents.index_version = search_server.GetIndexVersion();
+    return contents;
+}
+
+// AddDocuments(seq) and AddDocuments(par) must build the same index as AddDocument called for every
+// document, and must leave the server unchanged when a document of the batch is rejected.
+void CheckBulkIndexing(const string& stop_words, const vector<string>& dictionary, const vector<string>& texts) {
+    vector<NewDocument> documents;
+    for (size_t i = 0; i < 2'000; ++i) {
+        documents.push_back({ static_cast<int>(i * 3), texts[i], static_cast<DocumentStatus>(i % 4),
+                              { static_cast<int>(i % 7), -static_cast<int>(i % 5) } });
+    }
+    string all_words_query;
+    for (const string& word : dictionary) {
+        all_words_query.append(word).push_back(' ');
+    }
+    all_words_query.pop_back();
+
+    SearchServer one_by_one(stop_words);
+    for (const NewDocument& document : documents) {
+        one_by_one.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    SearchServer sequential(stop_words);
+    sequential.AddDocuments(execution::seq, documents);
+    SearchServer parallel(stop_words);
+    parallel.AddDocuments(execution::par, documents);
+
+    IndexContents reference = GetIndexContents(one_by_one, all_words_query);
+    // A batch changes the version once, AddDocument once per document.
+    reference.index_version = sequential.GetIndexVersion();
+    CHECK(reference.columns.size() == documents.size());
+    CHECK(GetIndexContents(sequential, all_words_query) == reference);
+    CHECK(GetIndexContents(parallel, all_words_query) == reference);
+    for (size_t i = 0; i < 100; ++i) {
+        const string_view text = texts[texts.size() - 1 - i];
+        const string_view query = text.substr(0, text.find(' ', 60));
+        const auto expected = one_by_one.FindTopDocuments(query, DocumentStatus::ACTUAL, 20);
+        CHECK(AreSameDocuments(sequential.FindTopDocuments(query, DocumentStatus::ACTUAL, 20), expected));
+        CHECK(AreSameDocuments(parallel.FindTopDocuments(query, DocumentStatus::ACTUAL, 20), expected));
+    }
+
+    const string invalid_text = "valid in\x01valid"s;
+    const auto check_rejected = [&](vector<NewDocument> batch) {
+        for (SearchServer* search_server : {&sequential, &parallel}) {
+            const IndexContents before = GetIndexContents(*search_server, all_words_query);
+            bool is_rejected = false;
+            try {
+                if (search_server == &sequential) {
+                    search_server->AddDocuments(execution::seq, batch);
+                } else {
+                    search_server->AddDocuments(execution::par, batch);
+                }
+            } catch (const invalid_argument&) {
+                is_rejected = true;
+            }
+            CHECK(is_rejected);
+            CHECK(GetIndexContents(*search_server, all_words_query) == before);
+        }
+    };
+    vector<NewDocument> batch;
+    for (size_t i = documents.size(); i < documents.size() + 200; ++i) {
+        batch.push_back({ static_cast<int>(i * 3), texts[i], DocumentStatus::ACTUAL, { 1 } });
+    }
+    vector<NewDocument> repeated_id_batch = batch;
+    repeated_id_batch[150].id = repeated_id_batch[20].id;
+    check_rejected(repeated_id_batch);
+    vector<NewDocument> indexed_id_batch = batch;
+    indexed_id_batch[100].id = documents[10].id;
+    check_rejected(indexed_id_batch);
+    vector<NewDocument> invalid_word_batch = batch;
+    invalid_word_batch[100].text = invalid_text;
+    check_rejected(invalid_word_batch);
+}
+
+// Counts occurrences of every word of the corpus from parallel threads.
+void TestConcurrentMap(const vector<string>& documents) {
+    size_t total_count = 0;
+    {
+        LOG_DURATION("word counts in mutex-guarded std::map"s);
+        mutex counts_mutex;
+        map<string_view, int> counts;
+        for_each(execution::par, documents.begin(), documents.end(), [&counts_mutex, &counts](const string& document) {
+            for (const string_view word : SplitIntoWordsView(document)) {
+                lock_guard guard(counts_mutex);
+                ++counts[word];
+            }
+        });
+        total_count += counts.size();
+    }
+    {
+        LOG_DURATION("word counts in ConcurrentMap"s);
+        ConcurrentMap<string_view, int> counts(THREADS_COUNT * 4);
+        for_each(execution::par, documents.begin(), documents.end(), [&counts](const string& document) {
+            for (const string_view word : SplitIntoWordsView(document)) {
+                counts.Add(word, 1);
+            }
+        });
+        total_count += counts.Collect(execution::par).size();
+    }
+    cout << total_count << endl;
+}
+
+// Removes every other document one by one and then in one RemoveDocuments call.
+void TestRemoval(const string& stop_words, const vector<NewDocument>& documents) {
+    vector<int> document_ids;
+    for (size_t i = 0; i < documents.size(); i += 2) {
+        document_ids.push_back(documents[i].id);
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, documents);
+        LOG_DURATION("RemoveDocument(par) of half the documents"s);
+        for (const int document_id : document_ids) {
+            search_server.RemoveDocument(execution::par, document_id);
+        }
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, documents);
+        LOG_DURATION("RemoveDocuments(par) of half the documents"s);
+        search_server.RemoveDocuments(execution::par, document_ids);
+    }
+}
+
+// search_server must find the same documents with the same relevance as expected, which indexes
+// only the documents that search_server should have, so document frequencies and IDF have to
+// leave out removed documents. None of removed_ids may reach a predicate or a result.
+void CheckSameIndex(const SearchServer& search_server, const SearchServer& expected, const set<int>& removed_ids,
+                    const string& all_words_query, const vector<string>& queries) {
+    CHECK(search_server.GetDocumentCount() == expected.GetDocumentCount());
+    IndexContents contents = GetIndexContents(search_server, all_words_query);
+    IndexContents expected_contents = GetIndexContents(expected, all_words_query);
+    CHECK(contents.document_ids == expected_contents.document_ids);
+    CHECK(contents.postings == expected_contents.postings);
+    CHECK(contents.columns == expected_contents.columns);
+    for (const auto& [document_id, column] : contents.columns) {
+        CHECK(removed_ids.count(document_id) == 0);
+    }
+    for (const string& query : queries) {
+        const auto found = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 50);
+        for (const Document& document : found) {
+            CHECK(removed_ids.count(document.id) == 0);
+        }
+        CHECK(AreSameDocuments(found, expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 50)));
+        CHECK(AreSameDocuments(search_server.FindTopDocuments(execution::par, query, DocumentStatus::ACTUAL, 50), found));
+    }
+}
+
+// Removes every other document of a corpus large enough to start a background compaction, checks
+// the index before and after the compaction is done and adds the removed documents back.
+void CheckRemoval(const string& stop_words, const vector<string>& dictionary, const vector<NewDocument>& documents,
+                  const vector<string>& queries) {
+    const vector<NewDocument> corpus(documents.begin(), documents.begin() + 3'000);
+    vector<NewDocument> kept_documents;
+    vector<NewDocument> removed_documents;
+    set<int> removed_ids;
+    for (size_t i = 0; i < corpus.size(); ++i) {
+        if (i % 2 == 0) {
+            removed_documents.push_back(corpus[i]);
+            removed_ids.insert(corpus[i].id);
+        } else {
+            kept_documents.push_back(corpus[i]);
+        }
+    }
+    string all_words_query;
+    for (const string& word : dictionary) {
+        all_words_query.append(word).push_back(' ');
+    }
+    all_words_query.pop_back();
+    const vector<string> checked_queries(queries.begin(), queries.begin() + 100);
+
+    SearchServer all(stop_words);
+    all.AddDocuments(execution::par, corpus);
+    SearchServer kept(stop_words);
+    kept.AddDocuments(execution::par, kept_documents);
+
+    for (int removal = 0; removal < 3; ++removal) {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, corpus);
+        if (removal == 0) {
+            for (const int document_id : removed_ids) {
+                search_server.RemoveDocument(document_id);
+            }
+        } else if (removal == 1) {
+            for (const int document_id : removed_ids) {
+                search_server.RemoveDocument(execution::par, document_id);
+            }
+        } else {
+            search_server.RemoveDocuments(execution::par, removed_ids);
+        }
+        // Removing an unknown or already removed id changes nothing.
+        search_server.RemoveDocument(*removed_ids.begin());
+        search_server.RemoveDocument(-1);
+        CheckSameIndex(search_server, kept, removed_ids, all_words_query, checked_queries);
+        search_server.CompactDeletedDocuments();
+        CheckSameIndex(search_server, kept, removed_ids, all_words_query, checked_queries);
+
+        search_server.AddDocuments(execution::seq, removed_documents);
+        CheckSameIndex(search_server, all, {}, all_words_query, checked_queries);
+    }
+
+    // Adding a removed document back before its postings are erased.
+    SearchServer search_server(stop_words);
+    search_server.AddDocuments(execution::par, corpus);
+    for (const NewDocument& document : removed_documents) {
+        search_server.RemoveDocument(document.id);
+        search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    CheckSameIndex(search_server, all, {}, all_words_query, checked_queries);
+    search_server.CompactDeletedDocuments();
+    CheckSameIndex(search_server, all, {}, all_words_query, checked_queries);
+}
+
+// The corpus followed by a copy of every fourth document with its words in reverse order.
+void TestRemoveDuplicates(const string& stop_words, const vector<NewDocument>& documents) {
+    vector<NewDocument> corpus = documents;
+    vector<string> copies;
+    for (size_t i = 0; i < documents.size(); i += 4) {
+        vector<string_view> words = SplitIntoWordsView(documents[i].text);
+        string copy;
+        for (auto it = words.rbegin(); it != words.rend(); ++it) {
+            copy.append(*it).push_back(' ');
+        }
+        copies.push_back(move(copy));
+    }
+    for (size_t i = 0; i < copies.size(); ++i) {
+        corpus.push_back({static_cast<int>(documents.size() + i), copies[i], DocumentStatus::ACTUAL, {1}});
+    }
+    // Ids of documents with the same words as a document of lower id, in ascending order.
+    vector<int> duplicates;
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, corpus);
+        LOG_DURATION("duplicates in std::set<std::set<std::string>>"s);
+        set<set<string>> existing_documents;
+        for (const int document_id : search_server) {
+            set<string> words;
+            for (const auto& [word, freq] : search_server.GetWordFrequencies(document_id)) {
+                words.emplace(word);
+            }
+            if (!existing_documents.insert(move(words)).second) {
+                duplicates.push_back(document_id);
+            }
+        }
+        search_server.RemoveDocuments(execution::seq, duplicates);
+        cout << duplicates.size() << " duplicates"s << endl;
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, corpus);
+        LOG_DURATION("RemoveDuplicates(seq)"s);
+        CHECK(RemoveDuplicates(execution::seq, search_server) == duplicates);
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, corpus);
+        {
+            LOG_DURATION("RemoveDuplicates(par)"s);
+            CHECK(RemoveDuplicates(execution::par, search_server) == duplicates);
+        }
+        for (const int document_id : duplicates) {
+            CHECK(find(search_server.begin(), search_server.end(), document_id) == search_server.end());
+        }
+        CHECK(search_server.GetDocumentCount() == static_cast<int>(corpus.size() - duplicates.size()));
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, corpus);
+        LOG_DURATION("RemoveNearDuplicates(par)"s);
+        // Random documents of the corpus are far apart, so only the exact copies are removed.
+        CHECK(RemoveNearDuplicates(execution::par, search_server) == duplicates);
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.SetDuplicatePolicy(DuplicatePolicy::REJECT);
+        LOG_DURATION("AddDocument with DuplicatePolicy::REJECT"s);
+        vector<int> rejected_ids;
+        for (const NewDocument& document : corpus) {
+            try {
+                search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+            } catch (const invalid_argument&) {
+                rejected_ids.push_back(document.id);
+            }
+        }
+        CHECK(rejected_ids == duplicates);
+        cout << rejected_ids.size() << " duplicates"s << endl;
+    }
+
+    // Long documents of the corpus, which are far apart, and copies of every eighth of them with one
+    // word replaced, which have a Jaccard similarity above 0.9 with the original.
+    vector<NewDocument> near_corpus;
+    vector<string> near_copies;
+    vector<int> near_duplicates;
+    for (const NewDocument& document : documents) {
+        vector<string_view> words = SplitIntoWordsView(document.text);
+        if (set<string_view>(words.begin(), words.end()).size() < 30) {
+            continue;
+        }
+        near_corpus.push_back(document);
+        if (near_corpus.size() % 8 == 0) {
+            string copy = "replacedword"s;
+            for (size_t j = 1; j < words.size(); ++j) {
+                copy.append(" "s).append(words[j]);
+            }
+            near_copies.push_back(move(copy));
+        }
+    }
+    for (size_t i = 0; i < near_copies.size(); ++i) {
+        near_duplicates.push_back(static_cast<int>(documents.size() + i));
+        near_corpus.push_back({near_duplicates.back(), near_copies[i], DocumentStatus::ACTUAL, {1}});
+    }
+    {
+        SearchServer search_server(stop_words);
+        search_server.AddDocuments(execution::par, near_corpus);
+        CHECK(RemoveNearDuplicates(execution::seq, search_server, { 0.99 }).empty());
+        CHECK(RemoveNearDuplicates(execution::seq, search_server, { 0.9 }) == near_duplicates);
+    }
+}
+
+// A document with the words of an indexed one in another order, with repeats and stop words, is a
+// duplicate; one with as many words of which one differs is not.
+void CheckDuplicatePolicy() {
+    const string original = "white cat and yellow hat"s;
+    const string duplicate = "hat yellow in cat white white with"s;
+    const string different = "white cat and yellow dog"s;
+    const auto is_rejected = [](SearchServer& search_server, int document_id, const string& text) {
+        try {
+            search_server.AddDocument(document_id, text, DocumentStatus::ACTUAL, { 1 });
+        } catch (const invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    {
+        SearchServer search_server("and in with"s);
+        search_server.SetDuplicatePolicy(DuplicatePolicy::REJECT);
+        CHECK(!is_rejected(search_server, 1, original));
+        CHECK(is_rejected(search_server, 2, duplicate));
+        CHECK(search_server.GetDocumentCount() == 1);
+        CHECK(!is_rejected(search_server, 3, different));
+        CHECK(!is_rejected(search_server, 4, "white cat yellow"s));
+        // The id of a rejected document is free, and a removed document no longer has duplicates.
+        CHECK(!is_rejected(search_server, 2, "curly tail"s));
+        search_server.RemoveDocument(1);
+        CHECK(!is_rejected(search_server, 5, duplicate));
+        CHECK(is_rejected(search_server, 6, original));
+        CHECK(search_server.GetDocumentCount() == 4);
+    }
+    {
+        SearchServer search_server("and in with"s);
+        search_server.SetDuplicatePolicy(DuplicatePolicy::REPORT);
+        CHECK(!is_rejected(search_server, 1, original));
+        CHECK(!is_rejected(search_server, 2, duplicate));
+        CHECK(!is_rejected(search_server, 3, different));
+        CHECK(!is_rejected(search_server, 4, original));
+        CHECK((search_server.TakeDuplicateReports() == vector<pair<int, int>>{ { 2, 1 }, { 4, 1 } }));
+        CHECK(search_server.TakeDuplicateReports().empty());
+    }
+    {
+        // Documents indexed before detection is turned on are registered without reports.
+        SearchServer search_server("and in with"s);
+        CHECK(!is_rejected(search_server, 1, original));
+        CHECK(!is_rejected(search_server, 2, duplicate));
+        search_server.SetDuplicatePolicy(DuplicatePolicy::REPORT);
+        CHECK(search_server.TakeDuplicateReports().empty());
+        CHECK(!is_rejected(search_server, 3, different));
+        CHECK(!is_rejected(search_server, 4, duplicate));
+        CHECK((search_server.TakeDuplicateReports() == vector<pair<int, int>>{ { 4, 1 } }));
+    }
+}
+
+// Keeps half of the corpus indexed while replacing the oldest document with a new one, with a query
+// after every few changes.
+void TestChurn(const string& stop_words, const vector<NewDocument>& documents, const vector<string>& queries) {
+    const size_t window = documents.size() / 2;
+    SearchServer search_server(stop_words);
+    search_server.AddDocuments(execution::par, vector<NewDocument>(documents.begin(), documents.begin() + window));
+    chrono::duration<double, milli> max_query_time{0};
+    chrono::duration<double, milli> total_query_time{0};
+    chrono::duration<double, milli> max_removal_time{0};
+    chrono::duration<double, milli> total_removal_time{0};
+    size_t query_count = 0;
+    double total_relevance = 0;
+    {
+        LOG_DURATION("churn"s);
+        for (size_t i = window; i < documents.size(); ++i) {
+            const NewDocument& document = documents[i];
+            search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+            const auto removal_start_time = chrono::steady_clock::now();
+            search_server.RemoveDocument(documents[i - window].id);
+            const chrono::duration<double, milli> removal_time = chrono::steady_clock::now() - removal_start_time;
+            max_removal_time = max(max_removal_time, removal_time);
+            total_removal_time += removal_time;
+            if (i % 10 == 0) {
+                const auto start_time = chrono::steady_clock::now();
+                for (const auto& found : search_server.FindTopDocuments(queries[query_count++ % queries.size()])) {
+                    total_relevance += found.relevance;
+                }
+                const chrono::duration<double, milli> query_time = chrono::steady_clock::now() - start_time;
+                max_query_time = max(max_query_time, query_time);
+                total_query_time += query_time;
+            }
+        }
+    }
+    cout << total_relevance << endl;
+    cout << "churn queries: "s << query_count << ", average "s << total_query_time.count() / query_count
+         << " ms, max "s << max_query_time.count() << " ms"s << endl;    cout << "churn removals: "s << documents.size() - window << ", average "s
+         << total_removal_time.count() / (documents.size() - window) << " ms, max "s << max_removal_time.count() << " ms"s << endl;
+}
+
+// A batch of mostly short queries with a few long ones at its end: std::transform(par) runs every
+// query in one thread, while the scheduler splits the long ones.
+void TestSkewedBatch(const SearchServer& search_server, mt19937& generator, const vector<string>& dictionary) {
+    vector<string> queries = GenerateQueries(generator, dictionary, 380, 3);
+    const vector<string> heavy_queries = GenerateQueries(generator, dictionary, 20, 500);
+    queries.insert(queries.end(), heavy_queries.begin(), heavy_queries.end());
+    double total_relevance = 0;
+    {
+        LOG_DURATION("skewed batch, transform(par)"s);
+        vector<vector<Document>> result(queries.size());
+        transform(execution::par, queries.begin(), queries.end(), result.begin(), [&search_server](const string& query) {
+            return search_server.FindTopDocuments(query);
+        });
+        for (const auto& documents : result) {
+            for (const Document& document : documents) {
+                total_relevance += document.relevance;
+            }
+        }
+    }
+    cout << total_relevance << endl;
+    for (const size_t thread_count : {size_t{1}, max<size_t>(THREADS_COUNT, 2)}) {
+        TaskScheduler scheduler(thread_count);
+        total_relevance = 0;
+        LOG_DURATION("skewed batch, TaskScheduler with "s + to_string(thread_count) + " threads"s);
+        for (const auto& documents : ProcessQueries(scheduler, search_server, queries)) {
+            for (const Document& document : documents) {
+                total_relevance += document.relevance;
+            }
+        }
+        cout << total_relevance << endl;
+    }
+}
+
+// A thread waiting for a long task with nothing else to run has to sleep rather than spin:
+// the process spends almost no CPU time while the only task sleeps.
+void CheckWaitSleeps() {
+    const auto task_duration = 200ms;
+    TaskScheduler scheduler(2);
+    for (int wait_kind = 0; wait_kind < 2; ++wait_kind) {
+        TaskGroup group;
+        atomic<bool> is_done = false;
+        scheduler.Spawn(group, [&is_done, task_duration] {
+            this_thread::sleep_for(task_duration);
+            is_done.store(true);
+        });
+        const clock_t start_cpu_time = clock();
+        if (wait_kind == 0) {
+            scheduler.Wait(group);
+        } else {
+            scheduler.WaitUntil([&is_done] {
+                return is_done.load();
+            });
+            scheduler.Wait(group);
+        }
+        const auto cpu_time = chrono::duration<double>((clock() - start_cpu_time) * 1.0 / CLOCKS_PER_SEC);
+        CHECK(cpu_time < task_duration / 4);
+    }
+}
+
+// Joins the results of a large batch of short queries: as nested vectors copied into one,
+// in a single packed buffer, and streamed to a sink.
+void TestJoinedQueries(const SearchServer& search_server, mt19937& generator, const vector<string>& dictionary) {
+    const vector<string> queries = GenerateQueries(generator, dictionary, 20'000, 3);
+    size_t document_count = 0;
+    size_t start_allocated_bytes = allocated_bytes;
+    {
+        LOG_DURATION("joined through ProcessQueries"s);
+        vector<Document> documents;
+        for (const auto& query_documents : ProcessQueries(search_server, queries)) {
+            documents.insert(documents.end(), query_documents.begin(), query_documents.end());
+        }
+        document_count += documents.size();
+    }
+    cout << "bytes allocated: "s << allocated_bytes - start_allocated_bytes << endl;
+    start_allocated_bytes = allocated_bytes;
+    {
+        LOG_DURATION("ProcessQueriesJoined"s);
+        document_count += ProcessQueriesJoined(search_server, queries).size();
+    }
+    cout << "bytes allocated: "s << allocated_bytes - start_allocated_bytes << endl;
+    start_allocated_bytes = allocated_bytes;
+    {
+        LOG_DURATION("ProcessQueriesJoined to a sink"s);
+        size_t next_query_index = 0;
+        ProcessQueriesJoined(search_server, queries, [&document_count, &next_query_index](size_t query_index, const vector<Document>& documents) {
+            CHECK(query_index == next_query_index++);
+            document_count += documents.size();
+        });
+        CHECK(next_query_index == queries.size());
+    }
+    cout << "bytes allocated: "s << allocated_bytes - start_allocated_bytes << endl;
+    cout << document_count << endl;
+
+    // A sink that throws while the window is full, with an invalid query in flight: the exception
+    // of the sink leaves once the queries in flight are done, and the scheduler goes on working.
+    vector<string> failing_queries = queries;
+    failing_queries[500] = "--invalid"s;
+    size_t sink_call_count = 0;
+    bool is_sink_error = false;
+    try {
+        ProcessQueriesJoined(search_server, failing_queries, [&sink_call_count](size_t query_index, const vector<Document>&) {
+            ++sink_call_count;
+            if (query_index == 10) {
+                throw runtime_error("sink failed"s);
+            }
+        });
+    } catch (const runtime_error&) {
+        is_sink_error = true;
+    }
+    CHECK(is_sink_error && sink_call_count == 11);
+    size_t rerun_document_count = 0;
+    ProcessQueriesJoined(search_server, queries, [&rerun_document_count](size_t, const vector<Document>& documents) {
+        rerun_document_count += documents.size();
+    });
+    CHECK(rerun_document_count * 3 == document_count);
+}
+
+// Repetitive traffic: requests drawn from a small set of queries, with and without the result cache.
+void TestRequestCache(const SearchServer& search_server, mt19937& generator, const vector<string>& queries) {
+    vector<size_t> requests(2'000);
+    for (size_t& request : requests) {
+        // Skewed towards the first queries of the set.
+        request = min<size_t>(geometric_distribution<size_t>(0.05)(generator), queries.size() - 1);
+    }
+    double total_relevance = 0;
+    {
+        LOG_DURATION("requests without cache"s);
+        for (const size_t request : requests) {
+            for (const Document& document : search_server.FindTopDocuments(queries[request])) {
+                total_relevance += document.relevance;
+            }
+        }
+    }
+    RequestQueue request_queue(search_server);
+    {
+        LOG_DURATION("requests through RequestQueue"s);
+        for (const size_t request : requests) {
+            for (const Document& document : request_queue.AddFindRequest(queries[request])) {
+                total_relevance -= document.relevance;
+            }
+        }
+    }
+    const QueryResultCache::Stats stats = request_queue.GetCacheStats();
+    cout << "difference "s << total_relevance << ", hit rate "s << stats.GetHitRate() << ", cached entries "s << stats.entry_count
+         << ", cache bytes "s << stats.memory_bytes << endl;
+}
+
+// Cached results must be those of the server at the time of the request. Entries are kept apart by
+// status and by plus and minus words; stop words are dropped before the key is built, so queries
+// that differ only in them share an entry and still get the server's results.
+void CheckRequestCache() {
+    SearchServer search_server("and in with"s);
+    search_server.AddDocument(1, "white cat and yellow hat"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "curly cat curly tail"s, DocumentStatus::ACTUAL, { 2 });
+    search_server.AddDocument(3, "nasty dog with big eyes"s, DocumentStatus::BANNED, { 3 });
+    search_server.AddDocument(4, "nasty cat in hat"s, DocumentStatus::BANNED, { 4 });
+    RequestQueue request_queue(search_server);
+    const auto request = [&](string_view query, DocumentStatus status) {
+        vector<Document> documents = request_queue.AddFindRequest(query, status);
+        CHECK(AreSameDocuments(documents, search_server.FindTopDocuments(query, status)));
+        return documents;
+    };
+
+    const auto actual = request("cat hat"sv, DocumentStatus::ACTUAL);
+    CHECK(request("hat cat cat"sv, DocumentStatus::ACTUAL).size() == actual.size());
+    CHECK(request_queue.GetCacheStats().hits == 1);
+    const auto banned = request("cat hat"sv, DocumentStatus::BANNED);
+    CHECK(banned.size() == 1 && banned.front().id == 4);
+    CHECK(request_queue.GetCacheStats().entry_count == 2);
+    request("cat -hat"sv, DocumentStatus::ACTUAL);
+    request("cat hat -with"sv, DocumentStatus::ACTUAL);
+    request("cat and in hat"sv, DocumentStatus::ACTUAL);
+    request("nasty"sv, DocumentStatus::BANNED);
+    request("nasty with"sv, DocumentStatus::BANNED);
+    const QueryResultCache::Stats stats = request_queue.GetCacheStats();
+    CHECK(stats.entry_count == 4 && stats.hits == 4);
+
+    search_server.AddDocument(5, "cat hat cat hat"s, DocumentStatus::ACTUAL, { 5 });
+    CHECK(request("cat hat"sv, DocumentStatus::ACTUAL).front().id == 5);
+    search_server.AddDocument(6, "nasty nasty"s, DocumentStatus::BANNED, { 6 });
+    CHECK(request("nasty"sv, DocumentStatus::BANNED).front().id == 6);
+    search_server.RemoveDocument(5);
+    CHECK(request("cat hat"sv, DocumentStatus::ACTUAL).size() == actual.size());
+    search_server.RemoveDocument(1);
+    CHECK(request("cat hat"sv, DocumentStatus::ACTUAL).size() == actual.size() - 1);
+    CHECK(request("cat -hat"sv, DocumentStatus::ACTUAL).size() == 1);
+}
+
+// Indexes half of the corpus in segments and adds the other half from another thread while queries run.
+void TestSegmentedIndex(const string& stop_words, const vector<NewDocument>& documents, const vector<string>& queries) {
+    SegmentedSearchServer search_server(stop_words);
+    const size_t half = documents.size() / 2;
+    {
+        LOG_DURATION("SegmentedSearchServer::AddDocument"s);
+        for (size_t i = 0; i < half; ++i) {
+            search_server.AddDocument(documents[i].id, documents[i].text, documents[i].status, documents[i].ratings);
+        }
+        search_server.Flush();
+    }
+    Test("segmented seq"sv, search_server, queries, execution::seq);
+
+    atomic<bool> is_indexed = false;
+    size_t query_count = 0;
+    {
+        LOG_DURATION("ProcessQueries during AddDocument"s);
+        thread writer([&search_server, &documents, &is_indexed, half] {
+            for (size_t i = half; i < documents.size(); ++i) {
+                search_server.AddDocument(documents[i].id, documents[i].text, documents[i].status, documents[i].ratings);
+            }
+            search_server.Flush();
+            is_indexed = true;
+        });
+        while (!is_indexed) {
+            ProcessQueries(search_server, queries);
+            query_count += queries.size();
+        }
+        writer.join();
+    }
+    cout << "queries during indexing: "s << query_count << ", segments: "s << search_server.GetSegmentCount() << endl;
+}
+
+void CheckSameSegmentedResults(const SegmentedSearchServer& segmented, const SearchServer& expected, const vector<string>& queries,
+                               const vector<NewDocument>& documents) {
+    CHECK(segmented.GetDocumentCount() == expected.GetDocumentCount());
+    const auto is_even_rating = [](int, DocumentStatus, int rating) {
+        return rating % 2 == 0;
+    };
+    for (const string& query : queries) {
+        for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+            const auto found = segmented.FindTopDocuments(query, status, 20);
+            CHECK(AreSameDocuments(found, expected.FindTopDocuments(query, status, 20)));
+            CHECK(AreSameDocuments(segmented.FindTopDocuments(execution::par, query, status, 20), found));
+        }
+        CHECK(AreSameDocuments(segmented.FindTopDocuments(query, is_even_rating), expected.FindTopDocuments(query, is_even_rating)));
+    }
+    const string& query = queries.front();
+    for (size_t i = 0; i < documents.size(); i += 7) {
+        const int document_id = documents[i].id;
+        const bool is_indexed = find(expected.begin(), expected.end(), document_id) != expected.end();
+        try {
+            const auto [words, status] = segmented.MatchDocument(query, document_id);
+            CHECK(is_indexed);
+            const auto [expected_words, expected_status] = expected.MatchDocument(query, document_id);
+            CHECK(words == expected_words && status == expected_status);
+            CHECK(segmented.MatchDocument(execution::par, query, document_id) == segmented.MatchDocument(query, document_id));
+        } catch (const out_of_range&) {
+            CHECK(!is_indexed);
+        }
+    }
+}
+
+// Applies batches of additions and removals to a segmented index and to a SearchServer, which must
+// find the same documents with the same relevance, so IDF is counted over all segments. Large
+// batches are published on their own and start merges; removing most of a segment rewrites it.
+void CheckSegmentedIndex(const string& stop_words, const vector<string>& texts, const vector<string>& queries) {
+    vector<NewDocument> documents;
+    for (size_t i = 0; i < 6'000; ++i) {
+        documents.push_back({ static_cast<int>(i), texts[i], i % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL,
+                              { static_cast<int>(i % 9) } });
+    }
+    const vector<string> checked_queries(queries.begin(), queries.begin() + 30);
+    SegmentedSearchServer segmented(stop_words);
+    SearchServer expected(stop_words);
+    const auto add = [&](const NewDocument& document) {
+        segmented.AddDocument(document.id, document.text, document.status, document.ratings);
+        expected.AddDocument(document.id, document.text, document.status, document.ratings);
+    };
+    const auto remove = [&](int document_id) {
+        segmented.RemoveDocument(document_id);
+        expected.RemoveDocument(document_id);
+    };
+
+    size_t added_count = 0;
+    size_t max_segment_count = 0;
+    for (const size_t batch_size : { 300, 700, 1'500, 200, 900, 600, 1'100 }) {
+        for (size_t i = added_count; i < added_count + batch_size; ++i) {
+            add(documents[i]);
+            // Removes a document of an earlier batch and one that is not yet published.
+            if (i % 3 == 0) {
+                remove(documents[i / 3].id);
+            }
+            if (i % 11 == 0) {
+                remove(documents[i].id);
+            }
+        }
+        added_count += batch_size;
+        segmented.Flush();
+        max_segment_count = max(max_segment_count, segmented.GetSegmentCount());
+        CheckSameSegmentedResults(segmented, expected, checked_queries, documents);
+    }
+    CHECK(max_segment_count > 1);
+
+    // Removes the older half of the documents, some of them already removed, and adds some of them
+    // back with the same ids.
+    for (size_t i = 0; i < added_count / 2; ++i) {
+        remove(documents[i].id);
+    }
+    segmented.Flush();
+    CheckSameSegmentedResults(segmented, expected, checked_queries, documents);
+    for (size_t i = 0; i < added_count / 2; i += 4) {
+        add(documents[i]);
+    }
+    segmented.Flush();
+    CheckSameSegmentedResults(segmented, expected, checked_queries, documents);
+}
+
+// Runs FindTopDocuments and MatchDocument from several reader threads while a writer replaces
+// the oldest half of the corpus, and reports reader throughput and latency.
+void TestReadersDuringWrites(const string& stop_words, const vector<NewDocument>& documents, const vector<string>& queries) {
+    const size_t reader_count = max<size_t>(THREADS_COUNT, 4);
+    const size_t window = documents.size() / 2;
+    SegmentedSearchServer search_server(stop_words);
+    for (size_t i = 0; i < window; ++i) {
+        search_server.AddDocument(documents[i].id, documents[i].text, documents[i].status, documents[i].ratings);
+    }
+    search_server.Flush();
+
+    atomic<bool> is_written = false;
+    vector<vector<double>> latencies(reader_count);
+    vector<thread> readers;
+    const auto start_time = chrono::steady_clock::now();
+    for (size_t reader = 0; reader < reader_count; ++reader) {
+        readers.emplace_back([&search_server, &queries, &is_written, &latencies, reader] {
+            for (size_t i = reader; !is_written; ++i) {
+                const string& query = queries[i % queries.size()];
+                const auto query_start_time = chrono::steady_clock::now();
+                const auto found = search_server.FindTopDocuments(query);
+                try {
+                    if (!found.empty()) {
+                        search_server.MatchDocument(query, found.front().id);
+                    }
+                } catch (const out_of_range&) {
+                    // The document was removed after the search.
+                }
+                const chrono::duration<double, milli> query_time = chrono::steady_clock::now() - query_start_time;
+                latencies[reader].push_back(query_time.count());
+            }
+        });
+    }
+    for (size_t i = window; i < documents.size(); ++i) {
+        search_server.AddDocument(documents[i].id, documents[i].text, documents[i].status, documents[i].ratings);
+        search_server.RemoveDocument(documents[i - window].id);
+    }
+    search_server.Flush();
+    const chrono::duration<double> write_time = chrono::steady_clock::now() - start_time;
+    is_written = true;
+    for (thread& reader : readers) {
+        reader.join();
+    }
+    const chrono::duration<double> seconds = chrono::steady_clock::now() - start_time;
+
+    vector<double> all_latencies;
+    for (const auto& reader_latencies : latencies) {
+        all_latencies.insert(all_latencies.end(), reader_latencies.begin(), reader_latencies.end());
+    }
+    sort(all_latencies.begin(), all_latencies.end());
+    const auto percentile = [&all_latencies](double fraction) {
+        return all_latencies.empty() ? 0.0 : all_latencies[static_cast<size_t>(fraction * (all_latencies.size() - 1))];
+    };
+    cout << reader_count << " readers: "s << all_latencies.size() / seconds.count() << " queries/sec, p50 "s << percentile(0.5)
+         << " ms, p99 "s << percentile(0.99) << " ms, max "s << percentile(1.0) << " ms; writer: "s
+         << (documents.size() - window) / write_time.count() << " docs/sec"s << endl;
+}
+
+// Compares startup from a snapshot with indexing the corpus again. The snapshot is written to the
+// temporary directory and removed afterwards.
+void TestSnapshot(const SearchServer& search_server, const vector<string>& queries) {
+    const string path = (filesystem::temp_directory_path() / "search_server.snapshot"s).string();
+    {
+        LOG_DURATION("SaveSnapshot"s);
+        search_server.SaveSnapshot(path);
+    }
+    double total_relevance = 0;
+    {
+        LOG_DURATION("LoadSnapshot and first query"s);
+        const SearchServer loaded = SearchServer::LoadSnapshot(path);
+        for (const auto& document : loaded.FindTopDocuments(queries.front())) {
+            total_relevance += document.relevance;
+        }
+    }
+    cout << total_relevance << endl;
+    filesystem::remove(path);
+    filesystem::remove(path + ".tmp"s);
+}
+
 int main() {
     mt19937 generator;
 
@@ -75,12 +1286,62 @@ int main() {
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
 
     SearchServer search_server(dictionary[0]);
+    const size_t start_allocation_count = allocation_count;
+    const size_t start_allocated_bytes = allocated_bytes;
+    {
+        LOG_DURATION("AddDocument"s);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+        }
+    }
+    cout << "AddDocument allocations per document: "s
+         << (allocation_count - start_allocation_count) * 1.0 / documents.size() << ", bytes: "s
+         << (allocated_bytes - start_allocated_bytes) * 1.0 / documents.size() << endl;
+
+    vector<NewDocument> new_documents;
     for (size_t i = 0; i < documents.size(); ++i) {
-        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+        new_documents.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, {1, 2, 3}});
     }
+    CheckBulkIndexing(dictionary[0], dictionary, documents);
+    TestBulkIndexing("AddDocuments(seq)"sv, dictionary[0], new_documents, execution::seq);
+    TestBulkIndexing("AddDocuments(par)"sv, dictionary[0], new_documents, execution::par);
+    TestRemoval(dictionary[0], new_documents);
+    TestRemoveDuplicates(dictionary[0], new_documents);
+    CheckDuplicatePolicy();
+    TestConcurrentMap(documents);
+
+    TestTokenizer(documents);
+    TestStopWords(dictionary, documents);
 
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
 
     TEST(seq);
     TEST(par);
+    TestWand(search_server, queries);
+    TestWandSkewedWords(generator);
+    TestQueryAllocations(search_server, queries);
+    TestDocumentMetadata(search_server, queries);
+    CheckDocumentFilter(dictionary[0], documents, queries);
+    TestDocumentFilter(search_server, queries);
+    TestSkewedBatch(search_server, generator, dictionary);
+    CheckWaitSleeps();
+    TestJoinedQueries(search_server, generator, dictionary);
+    CheckRequestCache();
+    TestRequestCache(search_server, generator, queries);
+    TestSnapshot(search_server, queries);
+    CheckRemoval(dictionary[0], dictionary, new_documents, queries);
+    TestChurn(dictionary[0], new_documents, queries);
+    CheckSegmentedIndex(dictionary[0], documents, queries);
+    TestSegmentedIndex(dictionary[0], new_documents, queries);
+    TestReadersDuringWrites(dictionary[0], new_documents, queries);
+
+    {
+        LOG_DURATION("PrecomputeImpacts"s);
+        search_server.PrecomputeImpacts();
+    }
+    CheckWand(search_server, queries);
+    Test("seq with impacts"sv, search_server, queries, execution::seq);
+    Test("wand with impacts"sv, search_server, queries, pruning::wand);
+
+    TestPostingLayout(generator);
 }
\ No newline at end of file
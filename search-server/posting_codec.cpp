@@ -0,0 +1,179 @@
+#include "posting_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define POSTING_CODEC_AVX2 1
+#endif
+
+using namespace std;
+
+namespace {
+
+void UnpackBytesScalar(const uint8_t* input, size_t count, uint32_t* output) {
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = input[i];
+    }
+}
+
+void UnpackShortsScalar(const uint8_t* input, size_t count, uint32_t* output) {
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = static_cast<uint32_t>(input[2 * i]) | static_cast<uint32_t>(input[2 * i + 1]) << 8;
+    }
+}
+
+#if defined(__SSE2__)
+void UnpackBytesSse2(const uint8_t* input, size_t count, uint32_t* output) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 12), _mm_unpackhi_epi16(high, zero));
+    }
+    UnpackBytesScalar(input + i, count - i, output + i);
+}
+
+void UnpackShortsSse2(const uint8_t* input, size_t count, uint32_t* output) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_unpacklo_epi16(shorts, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 4), _mm_unpackhi_epi16(shorts, zero));
+    }
+    UnpackShortsScalar(input + 2 * i, count - i, output + i);
+}
+
+void PrefixSumSse2(uint32_t* values, size_t count, uint32_t base) {
+    __m128i carry = _mm_set1_epi32(static_cast<int>(base));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    uint32_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(carry));
+    for (; i < count; ++i) {
+        sum += values[i];
+        values[i] = sum;
+    }
+}
+#endif
+
+#if defined(POSTING_CODEC_AVX2)
+__attribute__((target("avx2")))
+void UnpackBytesAvx2(const uint8_t* input, size_t count, uint32_t* output) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_cvtepu8_epi32(bytes));
+    }
+    UnpackBytesScalar(input + i, count - i, output + i);
+}
+
+__attribute__((target("avx2")))
+void UnpackShortsAvx2(const uint8_t* input, size_t count, uint32_t* output) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_cvtepu16_epi32(shorts));
+    }
+    UnpackShortsScalar(input + 2 * i, count - i, output + i);
+}
+
+bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+void UnpackBytes(const uint8_t* input, size_t count, uint32_t* output) {
+#if defined(POSTING_CODEC_AVX2)
+    if (HasAvx2()) {
+        UnpackBytesAvx2(input, count, output);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    UnpackBytesSse2(input, count, output);
+#else
+    UnpackBytesScalar(input, count, output);
+#endif
+}
+
+void UnpackShorts(const uint8_t* input, size_t count, uint32_t* output) {
+#if defined(POSTING_CODEC_AVX2)
+    if (HasAvx2()) {
+        UnpackShortsAvx2(input, count, output);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    UnpackShortsSse2(input, count, output);
+#else
+    UnpackShortsScalar(input, count, output);
+#endif
+}
+
+} // namespace
+
+uint8_t GetByteWidth(uint32_t max_value) {
+    if (max_value <= UINT8_MAX) {
+        return 1;
+    }
+    if (max_value <= UINT16_MAX) {
+        return 2;
+    }
+    return 4;
+}
+
+void PackIntegers(const uint32_t* values, size_t count, uint8_t width, vector<uint8_t>& output) {
+    const size_t offset = output.size();
+    output.resize(offset + count * width);
+    uint8_t* data = output.data() + offset;
+    for (size_t i = 0; i < count; ++i) {
+        for (uint8_t byte = 0; byte < width; ++byte) {
+            *data++ = static_cast<uint8_t>(values[i] >> (8 * byte));
+        }
+    }
+}
+
+void UnpackIntegers(const uint8_t* input, size_t count, uint8_t width, uint32_t* output) {
+    switch (width) {
+        case 1:
+            UnpackBytes(input, count, output);
+            break;
+        case 2:
+            UnpackShorts(input, count, output);
+            break;
+        default:
+            for (size_t i = 0; i < count; ++i, input += 4) {
+                output[i] = static_cast<uint32_t>(input[0]) | static_cast<uint32_t>(input[1]) << 8
+                            | static_cast<uint32_t>(input[2]) << 16 | static_cast<uint32_t>(input[3]) << 24;
+            }
+            break;
+    }
+}
+
+void PrefixSum(uint32_t* values, size_t count, uint32_t base) {
+#if defined(__SSE2__)
+    PrefixSumSse2(values, count, base);
+#else
+    uint32_t sum = base;
+    for (size_t i = 0; i < count; ++i) {
+        sum += values[i];
+        values[i] = sum;
+    }
+#endif
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte-aligned integer packing used by compressed posting lists.
+// Values are stored little-endian with 1, 2 or 4 bytes each, which keeps decoding
+// branch-free and lets SSE2/AVX2 widen a whole register of values at once.
+// Builds without x86 SIMD fall back to scalar code with the same results.
+
+// Smallest width (1, 2 or 4 bytes) that fits max_value.
+uint8_t GetByteWidth(uint32_t max_value);
+
+// Appends count values of the given width to output.
+void PackIntegers(const uint32_t* values, size_t count, uint8_t width, std::vector<uint8_t>& output);
+
+// Widens count values of the given width into 32-bit integers.
+void UnpackIntegers(const uint8_t* input, size_t count, uint8_t width, uint32_t* output);
+
+// Turns deltas into absolute values in place: values[i] = base + values[0] + ... + values[i].
+void PrefixSum(uint32_t* values, size_t count, uint32_t base);
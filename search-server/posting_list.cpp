@@ -0,0 +1,310 @@
+#include "posting_list.h"
+#include "posting_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+float RoundUpToFloat(double value) {
+    const float rounded = static_cast<float>(value);
+    return rounded < value ? nextafter(rounded, HUGE_VALF) : rounded;
+}
+
+} // namespace
+
+PostingListView::Cursor::Cursor(const PostingListView& postings, size_t block_index)
+        : postings_(postings) {
+    LoadBlock(block_index);
+}
+
+void PostingListView::Cursor::LoadBlock(size_t block_index) {
+    block_index_ = block_index;
+    position_ = 0;
+    block_size_ = 0;
+    if (!AtEnd()) {
+        postings_.DecodeBlock(block_index_, ordinals_.data(), counts_.data());
+        block_size_ = postings_.blocks_[block_index_].size;
+    }
+}
+
+void PostingListView::Cursor::SkipTo(uint32_t document_ordinal) {
+    if (AtEnd() || GetOrdinal() >= document_ordinal) {
+        return;
+    }
+    if (ordinals_[block_size_ - 1] < document_ordinal) {
+        const PostingBlock* blocks = postings_.blocks_;
+        const PostingBlock* next_block = upper_bound(blocks + block_index_ + 1, blocks + postings_.block_count_, document_ordinal,
+                                                     [](uint32_t ordinal, const PostingBlock& block) {
+                                                         return ordinal < block.first_ordinal;
+                                                     });
+        const size_t block_index = next_block - blocks - 1;
+        if (block_index == block_index_) {
+            LoadBlock(block_index_ + 1);
+            return;
+        }
+        LoadBlock(block_index);
+    }
+    position_ = lower_bound(ordinals_.begin() + position_, ordinals_.begin() + block_size_, document_ordinal)
+                - ordinals_.begin();
+    if (position_ == block_size_) {
+        LoadBlock(block_index_ + 1);
+    }
+}
+
+PostingListView::BlockBound PostingListView::Cursor::GetBlockBound(uint32_t document_ordinal) const {
+    const PostingBlock* blocks = postings_.blocks_;
+    const PostingBlock* blocks_end = blocks + postings_.block_count_;
+    const PostingBlock* block = blocks + block_index_;
+    if (block + 1 != blocks_end && block[1].first_ordinal <= document_ordinal) {
+        block = upper_bound(block + 1, blocks_end, document_ordinal, [](uint32_t ordinal, const PostingBlock& next_block) {
+                    return ordinal < next_block.first_ordinal;
+                }) - 1;
+    }
+    return { block->max_term_freq, block + 1 == blocks_end ? UINT32_MAX : block[1].first_ordinal - 1 };
+}
+
+PostingListView::PostingListView(const PostingBlock* blocks, size_t block_count, const uint8_t* deltas, const uint8_t* counts,
+                                 size_t size, double max_term_freq)
+        : blocks_(blocks)
+        , block_count_(block_count)
+        , deltas_(deltas)
+        , counts_(counts)
+        , size_(size)
+        , max_term_freq_(max_term_freq) {
+}
+
+bool PostingListView::Contains(uint32_t document_ordinal) const {
+    if (block_count_ == 0) {
+        return false;
+    }
+    const PostingBlock& block = blocks_[FindBlock(document_ordinal)];
+    uint32_t ordinals[BLOCK_SIZE];
+    UnpackIntegers(deltas_ + block.delta_offset, block.size, block.delta_width, ordinals);
+    PrefixSum(ordinals, block.size, block.first_ordinal);
+    return binary_search(ordinals, ordinals + block.size, document_ordinal);
+}
+
+PostingListView::Cursor PostingListView::GetCursor() const {
+    return Cursor(*this, 0);
+}
+
+PostingListView::Cursor PostingListView::LowerBound(uint32_t document_ordinal) const {
+    Cursor cursor(*this, block_count_ == 0 ? 0 : FindBlock(document_ordinal));
+    cursor.SkipTo(document_ordinal);
+    return cursor;
+}
+
+size_t PostingListView::size() const {
+    return size_;
+}
+
+bool PostingListView::empty() const {
+    return size_ == 0;
+}
+
+double PostingListView::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+const PostingBlock* PostingListView::GetBlocks() const {
+    return blocks_;
+}
+
+size_t PostingListView::GetBlockCount() const {
+    return block_count_;
+}
+
+const uint8_t* PostingListView::GetDeltas() const {
+    return deltas_;
+}
+
+size_t PostingListView::GetDeltaBytes() const {
+    if (block_count_ == 0) {
+        return 0;
+    }
+    const PostingBlock& last_block = blocks_[block_count_ - 1];
+    return last_block.delta_offset + size_t{last_block.size} * last_block.delta_width;
+}
+
+const uint8_t* PostingListView::GetCounts() const {
+    return counts_;
+}
+
+size_t PostingListView::GetCountBytes() const {
+    if (block_count_ == 0) {
+        return 0;
+    }
+    const PostingBlock& last_block = blocks_[block_count_ - 1];
+    return last_block.count_offset + size_t{last_block.size} * last_block.count_width;
+}
+
+size_t PostingListView::FindBlock(uint32_t document_ordinal) const {
+    const PostingBlock* it = upper_bound(blocks_, blocks_ + block_count_, document_ordinal,
+                                         [](uint32_t ordinal, const PostingBlock& block) {
+                                             return ordinal < block.first_ordinal;
+                                         });
+    return it == blocks_ ? 0 : it - blocks_ - 1;
+}
+
+void PostingListView::DecodeBlock(size_t block_index, uint32_t* ordinals, uint32_t* counts) const {
+    const PostingBlock& block = blocks_[block_index];
+    UnpackIntegers(deltas_ + block.delta_offset, block.size, block.delta_width, ordinals);
+    PrefixSum(ordinals, block.size, block.first_ordinal);
+    UnpackIntegers(counts_ + block.count_offset, block.size, block.count_width, counts);
+}
+
+void PostingList::Add(uint32_t document_ordinal, uint32_t count, double term_freq) {
+    max_term_freq_ = max(max_term_freq_, term_freq);
+    if (blocks_.empty() || blocks_.back().size == BLOCK_SIZE) {
+        blocks_.push_back({ document_ordinal, static_cast<uint32_t>(deltas_.size()), static_cast<uint32_t>(counts_.size()), 0.0f, 0, 1, 1 });
+    }
+    const size_t block_index = blocks_.size() - 1;
+    PostingBlock& block = blocks_.back();
+    block.max_term_freq = max(block.max_term_freq, RoundUpToFloat(term_freq));
+    uint32_t delta = block.size > 0 ? document_ordinal - last_ordinal_ : 0;
+    if (GetByteWidth(delta) > block.delta_width || GetByteWidth(count) > block.count_width) {
+        uint32_t ordinals[BLOCK_SIZE];
+        uint32_t counts[BLOCK_SIZE];
+        GetView().DecodeBlock(block_index, ordinals, counts);
+        ordinals[block.size] = document_ordinal;
+        counts[block.size] = count;
+        StoreBlock(block_index, ordinals, counts, block.size + 1);
+    } else if (block.delta_width == 1 && block.count_width == 1) {
+        deltas_.push_back(static_cast<uint8_t>(delta));
+        counts_.push_back(static_cast<uint8_t>(count));
+        ++block.size;
+    } else {
+        PackIntegers(&delta, 1, block.delta_width, deltas_);
+        PackIntegers(&count, 1, block.count_width, counts_);
+        ++block.size;
+    }
+    last_ordinal_ = document_ordinal;
+    ++size_;
+}
+
+bool PostingList::Erase(uint32_t document_ordinal) {
+    if (blocks_.empty()) {
+        return false;
+    }
+    const size_t block_index = GetView().FindBlock(document_ordinal);
+    const size_t block_size = blocks_[block_index].size;
+    uint32_t ordinals[BLOCK_SIZE];
+    uint32_t counts[BLOCK_SIZE];
+    GetView().DecodeBlock(block_index, ordinals, counts);
+    const size_t position = lower_bound(ordinals, ordinals + block_size, document_ordinal) - ordinals;
+    if (position == block_size || ordinals[position] != document_ordinal) {
+        return false;
+    }
+    copy(ordinals + position + 1, ordinals + block_size, ordinals + position);
+    copy(counts + position + 1, counts + block_size, counts + position);
+    StoreBlock(block_index, ordinals, counts, block_size - 1);
+    if (--size_ == 0) {
+        max_term_freq_ = 0.0;
+    } else if (document_ordinal == last_ordinal_) {
+        GetView().DecodeBlock(blocks_.size() - 1, ordinals, counts);
+        last_ordinal_ = ordinals[blocks_.back().size - 1];
+    }
+    return true;
+}
+
+size_t PostingList::Erase(const uint32_t* first, const uint32_t* last) {
+    if (last - first == 1) {
+        return Erase(*first) ? 1 : 0;
+    }
+    PostingList rest;
+    size_t erased_count = 0;
+    for (auto cursor = GetCursor(); !cursor.AtEnd(); cursor.Next()) {
+        const uint32_t document_ordinal = cursor.GetOrdinal();
+        first = lower_bound(first, last, document_ordinal);
+        if (first != last && *first == document_ordinal) {
+            ++erased_count;
+            continue;
+        }
+        // Postings move between blocks, so each takes the bound of the block it comes from.
+        rest.Add(document_ordinal, cursor.GetCount(), cursor.GetBlockMaxTermFreq());
+    }
+    if (erased_count > 0) {
+        rest.max_term_freq_ = rest.empty() ? 0.0 : max_term_freq_;
+        *this = move(rest);
+    }
+    return erased_count;
+}
+
+PostingListView PostingList::GetView() const {
+    return PostingListView(blocks_.data(), blocks_.size(), deltas_.data(), counts_.data(), size_, max_term_freq_);
+}
+
+bool PostingList::Contains(uint32_t document_ordinal) const {
+    return GetView().Contains(document_ordinal);
+}
+
+PostingList::Cursor PostingList::GetCursor() const {
+    return GetView().GetCursor();
+}
+
+PostingList::Cursor PostingList::LowerBound(uint32_t document_ordinal) const {
+    return GetView().LowerBound(document_ordinal);
+}
+
+size_t PostingList::size() const {
+    return size_;
+}
+
+bool PostingList::empty() const {
+    return size_ == 0;
+}
+
+double PostingList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+size_t PostingList::GetMemoryUsage() const {
+    return sizeof(*this) + blocks_.capacity() * sizeof(PostingBlock) + deltas_.capacity() + counts_.capacity();
+}
+
+void PostingList::StoreBlock(size_t block_index, const uint32_t* ordinals, const uint32_t* counts, size_t size) {
+    PostingBlock& block = blocks_[block_index];
+    vector<uint8_t> deltas;
+    vector<uint8_t> packed_counts;
+    uint8_t delta_width = 1;
+    uint8_t count_width = 1;
+    if (size > 0) {
+        uint32_t block_deltas[BLOCK_SIZE];
+        block_deltas[0] = 0;
+        uint32_t max_delta = 0;
+        uint32_t max_count = counts[0];
+        for (size_t i = 1; i < size; ++i) {
+            block_deltas[i] = ordinals[i] - ordinals[i - 1];
+            max_delta = max(max_delta, block_deltas[i]);
+            max_count = max(max_count, counts[i]);
+        }
+        delta_width = GetByteWidth(max_delta);
+        count_width = GetByteWidth(max_count);
+        PackIntegers(block_deltas, size, delta_width, deltas);
+        PackIntegers(counts, size, count_width, packed_counts);
+    }
+
+    const size_t old_delta_bytes = size_t{block.size} * block.delta_width;
+    const size_t old_count_bytes = size_t{block.size} * block.count_width;
+    deltas_.erase(deltas_.begin() + block.delta_offset, deltas_.begin() + block.delta_offset + old_delta_bytes);
+    deltas_.insert(deltas_.begin() + block.delta_offset, deltas.begin(), deltas.end());
+    counts_.erase(counts_.begin() + block.count_offset, counts_.begin() + block.count_offset + old_count_bytes);
+    counts_.insert(counts_.begin() + block.count_offset, packed_counts.begin(), packed_counts.end());
+    for (size_t i = block_index + 1; i < blocks_.size(); ++i) {
+        blocks_[i].delta_offset = static_cast<uint32_t>(blocks_[i].delta_offset + deltas.size() - old_delta_bytes);
+        blocks_[i].count_offset = static_cast<uint32_t>(blocks_[i].count_offset + packed_counts.size() - old_count_bytes);
+    }
+
+    if (size == 0) {
+        blocks_.erase(blocks_.begin() + block_index);
+        return;
+    }
+    block.first_ordinal = ordinals[0];
+    block.size = static_cast<uint8_t>(size);
+    block.delta_width = delta_width;
+    block.count_width = count_width;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Postings of a single word sorted by document ordinal. A posting is the ordinal plus the number
+// of occurrences of the word in the document; the caller derives term frequency from it.
+// Postings are packed into blocks of up to BLOCK_SIZE entries: ordinals are delta-encoded and,
+// like counts, stored with the smallest byte width that fits the block (see posting_codec.h).
+// Offsets of a block are relative to the deltas and counts of its own list.
+struct PostingBlock {
+    uint32_t first_ordinal;
+    uint32_t delta_offset;
+    uint32_t count_offset;
+    // Upper bound of term frequency over the block, rounded up to a float.
+    float max_term_freq;
+    uint8_t size;
+    uint8_t delta_width;
+    uint8_t count_width;
+};
+
+// Read-only postings of a single word. A view points either into a PostingList
+// or into a memory-mapped index snapshot, and is invalidated when the list changes.
+class PostingListView {
+public:
+    static constexpr size_t BLOCK_SIZE = 128;
+
+    class Cursor;
+
+    // Term frequency bound of the block that may contain an ordinal, and the last ordinal
+    // the bound covers: the one before the next block.
+    struct BlockBound {
+        double max_term_freq;
+        uint32_t last_ordinal;
+    };
+
+    PostingListView() = default;
+    PostingListView(const PostingBlock* blocks, size_t block_count, const uint8_t* deltas, const uint8_t* counts,
+                    size_t size, double max_term_freq);
+
+    bool Contains(uint32_t document_ordinal) const;
+    Cursor GetCursor() const;
+    Cursor LowerBound(uint32_t document_ordinal) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // Upper bound of term frequency over the list, used to prune documents during evaluation.
+    double GetMaxTermFreq() const;
+
+    // Encoded representation, for writing the list out as is.
+    const PostingBlock* GetBlocks() const;
+    size_t GetBlockCount() const;
+    const uint8_t* GetDeltas() const;
+    size_t GetDeltaBytes() const;
+    const uint8_t* GetCounts() const;
+    size_t GetCountBytes() const;
+
+private:
+    friend class PostingList;
+
+    // Index of the block that may contain the ordinal: the last one starting at or before it.
+    size_t FindBlock(uint32_t document_ordinal) const;
+    void DecodeBlock(size_t block_index, uint32_t* ordinals, uint32_t* counts) const;
+
+    const PostingBlock* blocks_ = nullptr;
+    size_t block_count_ = 0;
+    const uint8_t* deltas_ = nullptr;
+    const uint8_t* counts_ = nullptr;
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+};
+
+// Forward cursor that decodes one block at a time.
+class PostingListView::Cursor {
+public:
+    bool AtEnd() const {
+        return block_index_ >= postings_.block_count_;
+    }
+
+    uint32_t GetOrdinal() const {
+        return ordinals_[position_];
+    }
+
+    uint32_t GetCount() const {
+        return counts_[position_];
+    }
+
+    // Slot of the posting when every block is given BLOCK_SIZE slots, for data kept per posting.
+    size_t GetPosition() const {
+        return block_index_ * BLOCK_SIZE + position_;
+    }
+
+    void Next() {
+        if (++position_ == block_size_) {
+            LoadBlock(block_index_ + 1);
+        }
+    }
+
+    // Moves to the first posting with an ordinal not less than the given one,
+    // jumping over whole blocks without decoding them.
+    void SkipTo(uint32_t document_ordinal);
+
+    double GetBlockMaxTermFreq() const {
+        return postings_.blocks_[block_index_].max_term_freq;
+    }
+
+    // Bound of the block at or after the current one that may contain the ordinal,
+    // found without decoding; the ordinal must not be less than the current one.
+    BlockBound GetBlockBound(uint32_t document_ordinal) const;
+
+private:
+    friend class PostingListView;
+
+    Cursor(const PostingListView& postings, size_t block_index);
+    void LoadBlock(size_t block_index);
+
+    PostingListView postings_;
+    size_t block_index_ = 0;
+    size_t position_ = 0;
+    size_t block_size_ = 0;
+    std::array<uint32_t, BLOCK_SIZE> ordinals_;
+    std::array<uint32_t, BLOCK_SIZE> counts_;
+};
+
+// Mutable postings of a single word.
+// Ordinals are handed out in increasing order, so indexing a new document is an append.
+class PostingList {
+public:
+    static constexpr size_t BLOCK_SIZE = PostingListView::BLOCK_SIZE;
+    using Cursor = PostingListView::Cursor;
+
+    // Appends a posting; document_ordinal must be greater than every ordinal already in the list.
+    // term_freq is only used to maintain GetMaxTermFreq() and the bounds of the blocks.
+    void Add(uint32_t document_ordinal, uint32_t count, double term_freq);
+    bool Erase(uint32_t document_ordinal);
+    // Erases the postings of sorted ordinals, re-encoding the list once. Returns the number erased.
+    size_t Erase(const uint32_t* first, const uint32_t* last);
+
+    PostingListView GetView() const;
+
+    bool Contains(uint32_t document_ordinal) const;
+    Cursor GetCursor() const;
+    Cursor LowerBound(uint32_t document_ordinal) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    // Erasing a posting keeps the bound, which stays valid though it may become loose.
+    double GetMaxTermFreq() const;
+
+    size_t GetMemoryUsage() const;
+
+private:
+    // Re-encodes the block with new contents and removes it when size is zero.
+    void StoreBlock(size_t block_index, const uint32_t* ordinals, const uint32_t* counts, size_t size);
+
+    std::vector<PostingBlock> blocks_;
+    std::vector<uint8_t> deltas_;
+    std::vector<uint8_t> counts_;
+    size_t size_ = 0;
+    uint32_t last_ordinal_ = 0;
+    double max_term_freq_ = 0.0;
+};
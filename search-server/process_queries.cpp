@@ -1,35 +1,93 @@
 #include "process_queries.h"
+#include <algorithm>
 #include <execution>
 #include <functional>
+#include <numeric>
+#include <utility>
 
 #include <iostream>
 
 using namespace std;
 
+namespace {
+
+template <typename Server>
+vector<vector<Document>> ProcessQueriesOnScheduler(TaskScheduler& scheduler, const Server& search_server, const vector<string>& queries) {
+    vector<vector<Document>> result(queries.size());
+    const scheduling::task_policy policy{&scheduler};
+    scheduler.ParallelFor(queries.size(), [&search_server, &queries, &result, &policy](size_t i) {
+        result[i] = search_server.FindTopDocuments(policy, queries[i]);
+    });
+    return result;
+}
+
+}  // namespace
+
 vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries)
 {
-    vector<vector<Document>> result(queries.size());
-    transform(
-        execution::par,
-        queries.begin(),
-        queries.end(),
-        result.begin(),
-        [&search_server](const string query) {
-            return search_server.FindTopDocuments(query);
-        }
-    );
-    return result;    
-}
-
-vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
-    std::vector<Document> result;
-
-    vector<vector<Document>> documents_lists = ProcessQueries(search_server, queries);
-    
-    for (const auto documents : documents_lists) {
-        for(auto document : documents) {
-            result.push_back(document);
-        }
+    return ProcessQueriesOnScheduler(TaskScheduler::GetDefault(), search_server, queries);
+}
+
+vector<vector<Document>> ProcessQueries(TaskScheduler& scheduler, const SearchServer& search_server, const vector<string>& queries)
+{
+    return ProcessQueriesOnScheduler(scheduler, search_server, queries);
+}
+
+vector<vector<Document>> ProcessQueries(const SegmentedSearchServer& search_server, const vector<string>& queries)
+{
+    return ProcessQueriesOnScheduler(TaskScheduler::GetDefault(), search_server, queries);
+}
+
+vector<vector<Document>> ProcessQueries(TaskScheduler& scheduler, const SegmentedSearchServer& search_server, const vector<string>& queries)
+{
+    return ProcessQueriesOnScheduler(scheduler, search_server, queries);
+}
+
+JoinedDocuments::JoinedDocuments(vector<Document> documents, vector<size_t> offsets)
+        : documents_(move(documents))
+        , offsets_(move(offsets)) {
+}
+
+JoinedDocuments::const_iterator JoinedDocuments::begin() const {
+    return documents_.begin();
+}
+
+JoinedDocuments::const_iterator JoinedDocuments::end() const {
+    return documents_.end();
+}
+
+size_t JoinedDocuments::size() const {
+    return documents_.size();
+}
+
+size_t JoinedDocuments::GetQueryCount() const {
+    return offsets_.size() - 1;
+}
+
+IteratorRange<JoinedDocuments::const_iterator> JoinedDocuments::GetQueryDocuments(size_t query_index) const {
+    return {documents_.begin() + offsets_[query_index], documents_.begin() + offsets_[query_index + 1]};
+}
+
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
+    return ProcessQueriesJoined(TaskScheduler::GetDefault(), search_server, queries);
+}
+
+JoinedDocuments ProcessQueriesJoined(TaskScheduler& scheduler, const SearchServer& search_server, const vector<string>& queries) {
+    vector<Document> documents(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+    vector<size_t> offsets(queries.size() + 1, 0);
+    const scheduling::task_policy policy{&scheduler};
+    scheduler.ParallelFor(queries.size(), [&search_server, &queries, &documents, &offsets, &policy](size_t i) {
+        const vector<Document> found = search_server.FindTopDocuments(policy, queries[i]);
+        copy(found.begin(), found.end(), documents.begin() + i * MAX_RESULT_DOCUMENT_COUNT);
+        offsets[i + 1] = found.size();
+    });
+
+    partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    // A query's documents never move right, so packing them in query order overwrites only what is already packed.
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto first = documents.begin() + i * MAX_RESULT_DOCUMENT_COUNT;
+        move(first, first + (offsets[i + 1] - offsets[i]), documents.begin() + offsets[i]);
     }
-    return result;
-}
\ No newline at end of file
+    documents.resize(offsets.back());
+    return {move(documents), move(offsets)};
+}
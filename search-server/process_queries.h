@@ -1,9 +1,122 @@
 #pragma once
 
+#include "paginator.h"
 #include "search_server.h"
+#include "segmented_search_server.h"
+#include "task_scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+// Runs on TaskScheduler::GetDefault().
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
-std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
+// Every query is a task of the scheduler, and heavy queries are split into subtasks (see scheduling::task_policy).
+std::vector<std::vector<Document>> ProcessQueries(TaskScheduler& scheduler, const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Documents found by a batch of queries, back to back in query order in a single buffer.
+class JoinedDocuments {
+public:
+    using const_iterator = std::vector<Document>::const_iterator;
+
+    // offsets[i] is the position of the first document of query i; offsets.back() is the document count.
+    JoinedDocuments(std::vector<Document> documents, std::vector<size_t> offsets);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+
+    size_t GetQueryCount() const;
+    IteratorRange<const_iterator> GetQueryDocuments(size_t query_index) const;
+
+private:
+    std::vector<Document> documents_;
+    std::vector<size_t> offsets_;
+};
+
+// Every query writes its documents into its own MAX_RESULT_DOCUMENT_COUNT slots of the buffer,
+// and the slots are then packed in place by the prefix sums of their sizes.
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+JoinedDocuments ProcessQueriesJoined(TaskScheduler& scheduler, const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Calls sink(query_index, documents) for every query in order, as soon as the query and those
+// before it are done. At most QUERY_WINDOW queries are in flight, so memory doesn't grow with
+// the batch. An exception of a query is rethrown after the sink got the results of the others;
+// an exception of the sink is rethrown once the queries in flight have finished.
+template <typename Sink>
+void ProcessQueriesJoined(TaskScheduler& scheduler, const SearchServer& search_server, const std::vector<std::string>& queries, Sink sink);
+template <typename Sink>
+void ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries, Sink sink);
+
+// Documents may be added to and removed from the server while the queries run.
+std::vector<std::vector<Document>> ProcessQueries(const SegmentedSearchServer& search_server, const std::vector<std::string>& queries);
+std::vector<std::vector<Document>> ProcessQueries(TaskScheduler& scheduler, const SegmentedSearchServer& search_server,
+                                                  const std::vector<std::string>& queries);
+
+namespace process_queries_detail {
+
+inline constexpr size_t QUERY_WINDOW = 1024;
+
+struct QuerySlot {
+    std::vector<Document> documents;
+    std::atomic<bool> is_done = false;
+};
+
+} // namespace process_queries_detail
+
+template <typename Sink>
+void ProcessQueriesJoined(TaskScheduler& scheduler, const SearchServer& search_server, const std::vector<std::string>& queries, Sink sink) {
+    using process_queries_detail::QUERY_WINDOW;
+    const size_t window = std::min(QUERY_WINDOW, queries.size());
+    const auto slots = std::make_unique<process_queries_detail::QuerySlot[]>(window);
+    const scheduling::task_policy policy{&scheduler};
+    TaskGroup group;
+    const auto spawn = [&](size_t query_index) {
+        auto& slot = slots[query_index % window];
+        slot.is_done.store(false);
+        scheduler.Spawn(group, [&search_server, &queries, &policy, &slot, query_index] {
+            try {
+                slot.documents = search_server.FindTopDocuments(policy, queries[query_index]);
+            } catch (...) {
+                slot.documents.clear();
+                slot.is_done.store(true);
+                throw;
+            }
+            slot.is_done.store(true);
+        });
+    };
+
+    size_t spawned_count = 0;
+    try {
+        while (spawned_count < window) {
+            spawn(spawned_count++);
+        }
+        for (size_t query_index = 0; query_index < queries.size(); ++query_index) {
+            auto& slot = slots[query_index % window];
+            scheduler.WaitUntil([&slot] {
+                return slot.is_done.load();
+            });
+            sink(query_index, std::as_const(slot.documents));
+            if (spawned_count < queries.size()) {
+                spawn(spawned_count++);
+            }
+        }
+    } catch (...) {
+        // The queries in flight write into slots and report to group, so they have to finish
+        // before the exception of the sink leaves; their own exceptions are dropped.
+        try {
+            scheduler.Wait(group);
+        } catch (...) {
+        }
+        throw;
+    }
+    scheduler.Wait(group);
+}
+
+template <typename Sink>
+void ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries, Sink sink) {
+    ProcessQueriesJoined(TaskScheduler::GetDefault(), search_server, queries, sink);
+}
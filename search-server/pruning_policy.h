@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+namespace pruning {
+
+struct Stats {
+    uint64_t postings_scored = 0;
+    uint64_t postings_skipped = 0;
+};
+
+// Execution strategy for FindTopDocuments next to std::execution::seq/par.
+// Dynamic pruning over upper bounds of the tf-idf of every word and of every posting block
+// (block-max MaxScore): words whose bounds together cannot outrank the current top are only
+// looked up for documents that the other words match, and such a document is dropped as soon
+// as its bound falls below the top. The result is the same as with exhaustive scoring.
+// It pays off for queries that mix frequent words with rare ones and ask for a short top;
+// on queries of words of similar frequency the bound checks cost more than they skip.
+// When stats is set, the counters of every query are added to it.
+struct wand_policy {
+    Stats* stats = nullptr;
+};
+
+inline constexpr wand_policy wand{};
+
+} // namespace pruning
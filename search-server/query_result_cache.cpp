@@ -0,0 +1,90 @@
+#include "query_result_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+size_t QueryResultCache::KeyHash::operator()(const Key& key) const {
+    uint64_t hash = static_cast<uint64_t>(key.status);
+    const auto combine = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+    };
+    for (const uint32_t term : key.query.plus_terms) {
+        combine(term);
+    }
+    combine(UINT64_MAX);
+    for (const uint32_t term : key.query.minus_terms) {
+        combine(term);
+    }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+QueryResultCache::QueryResultCache(size_t capacity)
+        : shard_capacity_(max<size_t>((capacity + SHARD_COUNT - 1) / SHARD_COUNT, 1))
+        , shards_(SHARD_COUNT) {
+}
+
+optional<vector<Document>> QueryResultCache::Find(const Key& key, uint64_t index_version) {
+    Shard& shard = GetShard(key);
+    {
+        lock_guard lock(shard.mutex);
+        const auto it = shard.positions.find(key);
+        if (it != shard.positions.end()) {
+            if (it->second->index_version == index_version) {
+                shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+                hits_.fetch_add(1, memory_order_relaxed);
+                return it->second->documents;
+            }
+            Erase(shard, it->second);
+        }
+    }
+    misses_.fetch_add(1, memory_order_relaxed);
+    return nullopt;
+}
+
+void QueryResultCache::Insert(Key key, uint64_t index_version, vector<Document> documents) {
+    Shard& shard = GetShard(key);
+    lock_guard lock(shard.mutex);
+    if (const auto it = shard.positions.find(key); it != shard.positions.end()) {
+        Erase(shard, it->second);
+    }
+    shard.entries.push_front({move(key), index_version, move(documents)});
+    shard.positions.emplace(shard.entries.front().key, shard.entries.begin());
+    shard.memory_bytes += GetMemoryUsage(shard.entries.front());
+    while (shard.entries.size() > shard_capacity_) {
+        Erase(shard, prev(shard.entries.end()));
+    }
+}
+
+QueryResultCache::Stats QueryResultCache::GetStats() const {
+    Stats stats;
+    stats.hits = hits_.load(memory_order_relaxed);
+    stats.misses = misses_.load(memory_order_relaxed);
+    for (const Shard& shard : shards_) {
+        lock_guard lock(shard.mutex);
+        stats.entry_count += shard.entries.size();
+        stats.memory_bytes += shard.memory_bytes;
+    }
+    return stats;
+}
+
+// A list node and a hash table node, each with a copy of the key.
+size_t QueryResultCache::GetMemoryUsage(const Entry& entry) {
+    const size_t key_bytes = (entry.key.query.plus_terms.capacity() + entry.key.query.minus_terms.capacity()) * sizeof(uint32_t);
+    return sizeof(Entry) + 2 * sizeof(void*)
+           + sizeof(Key) + sizeof(void*) * 3
+           + 2 * key_bytes
+           + entry.documents.capacity() * sizeof(Document);
+}
+
+QueryResultCache::Shard& QueryResultCache::GetShard(const Key& key) {
+    return shards_[KeyHash()(key) % shards_.size()];
+}
+
+void QueryResultCache::Erase(Shard& shard, list<Entry>::iterator position) {
+    shard.memory_bytes -= GetMemoryUsage(*position);
+    shard.positions.erase(position->key);
+    shard.entries.erase(position);
+}
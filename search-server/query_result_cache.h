@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Top documents of recent queries to one SearchServer, for traffic that repeats queries.
+// Entries are keyed by the normalized query and the status searched for, and remember the index
+// version they were computed at: an entry of an older version is a miss and is dropped.
+// Keys are spread over shards, each with its own lock and its own least recently used order.
+class QueryResultCache {
+public:
+    struct Key {
+        SearchServer::QueryKey query;
+        DocumentStatus status;
+
+        bool operator==(const Key& other) const {
+            return status == other.status && query == other.query;
+        }
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entry_count = 0;
+        // Approximate heap memory held by the entries.
+        size_t memory_bytes = 0;
+
+        double GetHitRate() const {
+            return hits + misses == 0 ? 0.0 : hits * 1.0 / (hits + misses);
+        }
+    };
+
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+    static constexpr size_t SHARD_COUNT = 16;
+
+    // capacity is the total number of entries, split evenly between shards.
+    explicit QueryResultCache(size_t capacity = DEFAULT_CAPACITY);
+
+    std::optional<std::vector<Document>> Find(const Key& key, uint64_t index_version);
+    void Insert(Key key, uint64_t index_version, std::vector<Document> documents);
+
+    Stats GetStats() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry {
+        Key key;
+        uint64_t index_version;
+        std::vector<Document> documents;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> entries;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> positions;
+        size_t memory_bytes = 0;
+    };
+
+    static size_t GetMemoryUsage(const Entry& entry);
+    Shard& GetShard(const Key& key);
+    static void Erase(Shard& shard, std::list<Entry>::iterator position);
+
+    const size_t shard_capacity_;
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+};
@@ -1,31 +1,284 @@
 #include "remove_duplicates.h"
-#include "log_duration.h"
+#include "word_set_fingerprint.h"
 
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 using namespace std;
 
-void RemoveDuplicates(SearchServer& search_server) {
-    std::set<std::set<std::string>> existing_docs;
-    std::vector<int> found_duplicates;
-    
-    for (int document_id : search_server) {
-        const auto& freqs = search_server.GetWordFrequencies(document_id);
-        std::set<std::string> words;
-        
-        std::transform(freqs.begin(), freqs.end(), std::inserter(words, words.begin()),
-            [](auto p) {
-                return p.first;
-            });
-        
-        if (existing_docs.count(words) > 0) {
-            cout << "Found duplicate document id " << document_id << endl;
-            found_duplicates.push_back(document_id);
+namespace {
+
+// Candidates in an LSH bucket are compared with the first document of the bucket and this many
+// preceding ones, so that a bucket of many similar documents doesn't produce quadratically many pairs.
+constexpr size_t MAX_BUCKET_NEIGHBOUR_COUNT = 64;
+
+// Jaccard similarity of sorted term sets; two empty sets are equal.
+double ComputeJaccard(const vector<uint32_t>& lhs, const vector<uint32_t>& rhs) {
+    if (lhs.empty() && rhs.empty()) {
+        return 1.0;
+    }
+    size_t common = 0;
+    auto left = lhs.begin();
+    auto right = rhs.begin();
+    while (left != lhs.end() && right != rhs.end()) {
+        if (*left < *right) {
+            ++left;
+        } else if (*right < *left) {
+            ++right;
         } else {
-            existing_docs.insert(words);
+            ++common;
+            ++left;
+            ++right;
         }
     }
-    for (int id : found_duplicates) {
-        search_server.RemoveDocument(id);
+    return common * 1.0 / (lhs.size() + rhs.size() - common);
+}
+
+// Calls function(first, last) for contiguous ranges covering [0, count): one range with
+// a sequential policy, several per thread with a parallel one.
+template <typename ExecutionPolicy, typename Function>
+void ForEachRange(const ExecutionPolicy& policy, size_t count, Function function) {
+    size_t range_count = 1;
+    if constexpr (!is_same_v<decay_t<ExecutionPolicy>, execution::sequenced_policy>) {
+        range_count = min(max<size_t>(THREADS_COUNT, 1) * 4, max<size_t>(count, 1));
+    }
+    vector<size_t> ranges(range_count);
+    iota(ranges.begin(), ranges.end(), 0);
+    for_each(policy, ranges.begin(), ranges.end(), [count, range_count, &function](size_t range) {
+        function(count * range / range_count, count * (range + 1) / range_count);
+    });
+}
+
+// Ids of the documents with the same term set as a document of lower id, ascending.
+template <typename ExecutionPolicy>
+vector<int> FindDuplicates(const ExecutionPolicy& policy, const SearchServer& search_server) {
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    const size_t document_count = document_ids.size();
+
+    vector<WordSetFingerprint> fingerprints(document_count);
+    ForEachRange(policy, document_count, [&](size_t first, size_t last) {
+        vector<uint32_t> terms;
+        for (size_t index = first; index < last; ++index) {
+            search_server.GetDocumentTerms(document_ids[index], terms);
+            for (const uint32_t term : terms) {
+                fingerprints[index].Add(term);
+            }
+        }
+    });
+
+    vector<uint32_t> order(document_count);
+    iota(order.begin(), order.end(), 0);
+    sort(policy, order.begin(), order.end(), [&fingerprints](uint32_t lhs, uint32_t rhs) {
+        return pair(fingerprints[lhs], lhs) < pair(fingerprints[rhs], rhs);
+    });
+    // Groups of two or more documents with one fingerprint, as ranges of order.
+    vector<pair<size_t, size_t>> groups;
+    for (size_t first = 0; first < document_count;) {
+        size_t last = first + 1;
+        while (last < document_count && fingerprints[order[last]] == fingerprints[order[first]]) {
+            ++last;
+        }
+        if (last - first > 1) {
+            groups.push_back({ first, last });
+        }
+        first = last;
     }
-}
\ No newline at end of file
+
+    // Documents of a group come in order of id, so the first one with a term set is kept.
+    vector<char> is_duplicate(document_count, 0);
+    ForEachRange(policy, groups.size(), [&](size_t first, size_t last) {
+        vector<vector<uint32_t>> kept_terms;
+        vector<uint32_t> terms;
+        for (size_t group = first; group < last; ++group) {
+            kept_terms.clear();
+            for (size_t position = groups[group].first; position < groups[group].second; ++position) {
+                search_server.GetDocumentTerms(document_ids[order[position]], terms);
+                if (find(kept_terms.begin(), kept_terms.end(), terms) != kept_terms.end()) {
+                    is_duplicate[order[position]] = 1;
+                } else {
+                    kept_terms.push_back(terms);
+                }
+            }
+        }
+    });
+
+    vector<int> duplicates;
+    for (size_t index = 0; index < document_count; ++index) {
+        if (is_duplicate[index]) {
+            duplicates.push_back(document_ids[index]);
+        }
+    }
+    return duplicates;
+}
+
+// Ids of the documents of document_ids (ascending, without exact duplicates) that are similar
+// enough to a kept document of lower id, ascending.
+template <typename ExecutionPolicy>
+vector<int> FindNearDuplicates(const ExecutionPolicy& policy, const SearchServer& search_server, const vector<int>& document_ids,
+                               const NearDuplicateOptions& options) {
+    const size_t document_count = document_ids.size();
+    const size_t band_size = options.band_size;
+    const size_t hash_count = options.band_count * band_size;
+
+    // Hash k of a term is its mixed id xor a seed of its own, multiplied: cheaper than mixing per hash.
+    vector<uint64_t> seeds(hash_count);
+    for (size_t k = 0; k < hash_count; ++k) {
+        seeds[k] = WordSetFingerprint::Mix(k + 1);
+    }
+    // Only the key of every band is kept, by band: candidates are verified on their terms,
+    // so the signature of a document is dropped as soon as its bands are hashed.
+    vector<uint64_t> band_keys(options.band_count * document_count);
+    ForEachRange(policy, document_count, [&](size_t first, size_t last) {
+        vector<uint32_t> terms;
+        vector<uint64_t> signature(hash_count);
+        for (size_t index = first; index < last; ++index) {
+            search_server.GetDocumentTerms(document_ids[index], terms);
+            fill(signature.begin(), signature.end(), UINT64_MAX);
+            for (const uint32_t term : terms) {
+                const uint64_t term_hash = WordSetFingerprint::Mix(term);
+                for (size_t k = 0; k < hash_count; ++k) {
+                    uint64_t hash = (term_hash ^ seeds[k]) * 0x9E3779B97F4A7C15ull;
+                    hash ^= hash >> 32;
+                    signature[k] = min(signature[k], hash);
+                }
+            }
+            for (size_t band = 0; band < options.band_count; ++band) {
+                uint64_t key = band;
+                for (size_t row = 0; row < band_size; ++row) {
+                    key = WordSetFingerprint::Mix(key ^ signature[band * band_size + row]);
+                }
+                band_keys[band * document_count + index] = key;
+            }
+        }
+    });
+
+    // Candidate pairs as (later, earlier) document indexes.
+    vector<vector<pair<uint32_t, uint32_t>>> band_candidates(options.band_count);
+    vector<size_t> bands(options.band_count);
+    iota(bands.begin(), bands.end(), 0);
+    for_each(policy, bands.begin(), bands.end(), [&](size_t band) {
+        vector<pair<uint64_t, uint32_t>> keys(document_count);
+        for (size_t index = 0; index < document_count; ++index) {
+            keys[index] = { band_keys[band * document_count + index], static_cast<uint32_t>(index) };
+        }
+        sort(keys.begin(), keys.end());
+        auto& candidates = band_candidates[band];
+        for (size_t first = 0; first < document_count;) {
+            size_t last = first + 1;
+            while (last < document_count && keys[last].first == keys[first].first) {
+                ++last;
+            }
+            for (size_t later = first + 1; later < last; ++later) {
+                const size_t nearest = max(first, later - min(later, MAX_BUCKET_NEIGHBOUR_COUNT));
+                if (nearest > first) {
+                    candidates.push_back({ keys[later].second, keys[first].second });
+                }
+                for (size_t earlier = nearest; earlier < later; ++earlier) {
+                    candidates.push_back({ keys[later].second, keys[earlier].second });
+                }
+            }
+            first = last;
+        }
+    });
+    vector<pair<uint32_t, uint32_t>> candidates;
+    for (const auto& band : band_candidates) {
+        candidates.insert(candidates.end(), band.begin(), band.end());
+    }
+    sort(policy, candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+    vector<char> is_candidate(document_count, 0);
+    for (const auto& [later, earlier] : candidates) {
+        is_candidate[later] = 1;
+        is_candidate[earlier] = 1;
+    }
+    vector<vector<uint32_t>> document_terms(document_count);
+    ForEachRange(policy, document_count, [&](size_t first, size_t last) {
+        for (size_t index = first; index < last; ++index) {
+            if (is_candidate[index]) {
+                search_server.GetDocumentTerms(document_ids[index], document_terms[index]);
+            }
+        }
+    });
+    vector<char> is_similar(candidates.size(), 0);
+    ForEachRange(policy, candidates.size(), [&](size_t first, size_t last) {
+        for (size_t pair_index = first; pair_index < last; ++pair_index) {
+            const auto [later, earlier] = candidates[pair_index];
+            is_similar[pair_index] = ComputeJaccard(document_terms[later], document_terms[earlier]) >= options.min_jaccard;
+        }
+    });
+
+    // Pairs come in order of the later document, so whether the earlier one is kept is already known.
+    vector<char> is_removed(document_count, 0);
+    for (size_t pair_index = 0; pair_index < candidates.size(); ++pair_index) {
+        const auto [later, earlier] = candidates[pair_index];
+        if (is_similar[pair_index] && !is_removed[earlier]) {
+            is_removed[later] = 1;
+        }
+    }
+    vector<int> near_duplicates;
+    for (size_t index = 0; index < document_count; ++index) {
+        if (is_removed[index]) {
+            near_duplicates.push_back(document_ids[index]);
+        }
+    }
+    return near_duplicates;
+}
+
+template <typename ExecutionPolicy>
+vector<int> RemoveDuplicatesImpl(const ExecutionPolicy& policy, SearchServer& search_server) {
+    vector<int> duplicates = FindDuplicates(policy, search_server);
+    search_server.RemoveDocuments(policy, duplicates);
+    return duplicates;
+}
+
+template <typename ExecutionPolicy>
+vector<int> RemoveNearDuplicatesImpl(const ExecutionPolicy& policy, SearchServer& search_server, const NearDuplicateOptions& options) {
+    if (!(options.min_jaccard >= 0.0 && options.min_jaccard <= 1.0)) {
+        throw invalid_argument("Jaccard similarity threshold must be between 0 and 1"s);
+    }
+    if (options.band_count == 0 || options.band_size == 0) {
+        throw invalid_argument("MinHash bands must be non-empty"s);
+    }
+    vector<int> duplicates = RemoveDuplicatesImpl(policy, search_server);
+    const vector<int> document_ids(search_server.begin(), search_server.end());
+    const vector<int> near_duplicates = FindNearDuplicates(policy, search_server, document_ids, options);
+    search_server.RemoveDocuments(policy, near_duplicates);
+
+    vector<int> removed(duplicates.size() + near_duplicates.size());
+    merge(duplicates.begin(), duplicates.end(), near_duplicates.begin(), near_duplicates.end(), removed.begin());
+    return removed;
+}
+
+}  // namespace
+
+vector<int> RemoveDuplicates(SearchServer& search_server) {
+    return RemoveDuplicatesImpl(execution::seq, search_server);
+}
+
+vector<int> RemoveDuplicates(const execution::sequenced_policy& policy, SearchServer& search_server) {
+    return RemoveDuplicatesImpl(policy, search_server);
+}
+
+vector<int> RemoveDuplicates(const execution::parallel_policy& policy, SearchServer& search_server) {
+    return RemoveDuplicatesImpl(policy, search_server);
+}
+
+vector<int> RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options) {
+    return RemoveNearDuplicatesImpl(execution::seq, search_server, options);
+}
+
+vector<int> RemoveNearDuplicates(const execution::sequenced_policy& policy, SearchServer& search_server,
+                                 const NearDuplicateOptions& options) {
+    return RemoveNearDuplicatesImpl(policy, search_server, options);
+}
+
+vector<int> RemoveNearDuplicates(const execution::parallel_policy& policy, SearchServer& search_server,
+                                 const NearDuplicateOptions& options) {
+    return RemoveNearDuplicatesImpl(policy, search_server, options);
+}
@@ -1,4 +1,35 @@
 #pragma once
+
+#include <cstddef>
+#include <execution>
+#include <vector>
+
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
+// Removes every document with the same set of words as a document of lower id and returns
+// the removed ids in ascending order. Documents are grouped by a 128-bit fingerprint of their
+// term ids, and term sets within a group are compared, so a fingerprint collision removes nothing.
+// With std::execution::par fingerprints are computed and groups are checked in parallel.
+std::vector<int> RemoveDuplicates(SearchServer& search_server);
+std::vector<int> RemoveDuplicates(const std::execution::sequenced_policy&, SearchServer& search_server);
+std::vector<int> RemoveDuplicates(const std::execution::parallel_policy&, SearchServer& search_server);
+
+// Near-duplicates are found with MinHash signatures of band_count * band_size hashes split into bands:
+// documents that agree on a whole band are candidates, which becomes likely for Jaccard similarity
+// above about (1 / band_count) ^ (1 / band_size), 0.71 by default. Finding them takes a 64-bit
+// key per band and document, 128 bytes per document by default, besides the candidate pairs.
+struct NearDuplicateOptions {
+    double min_jaccard = 0.8;
+    size_t band_count = 16;
+    size_t band_size = 8;
+};
+
+// Removes exact duplicates as RemoveDuplicates does, then every document whose words have
+// a Jaccard similarity of at least min_jaccard with the words of a kept document of lower id,
+// and returns the removed ids in ascending order. The similarity of candidates is computed
+// exactly, so nothing below the threshold is removed; pairs that never become candidates are missed.
+std::vector<int> RemoveNearDuplicates(SearchServer& search_server, const NearDuplicateOptions& options = {});
+std::vector<int> RemoveNearDuplicates(const std::execution::sequenced_policy&, SearchServer& search_server,
+                                      const NearDuplicateOptions& options = {});
+std::vector<int> RemoveNearDuplicates(const std::execution::parallel_policy&, SearchServer& search_server,
+                                      const NearDuplicateOptions& options = {});
@@ -3,15 +3,36 @@
 using namespace std;
 
 RequestQueue::RequestQueue(const SearchServer& search_server)
+        : RequestQueue(search_server, make_shared<QueryResultCache>())
+{
+}
+
+RequestQueue::RequestQueue(const SearchServer& search_server, shared_ptr<QueryResultCache> cache)
         : search_server_(search_server)
+        , cache_(move(cache))
         , empty_count_(0)
 {
 }
 
+// The query is parsed once, for both the cache key and a search on a miss.
 vector<Document> RequestQueue::AddFindRequest(const string_view raw_query, DocumentStatus status) {
-    return AddFindRequest(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+    const SearchServer::QueryContextLease context;
+    search_server_.ParseQuery(raw_query, false, *context);
+    const SearchServer::Query& query = context->query;
+    QueryResultCache::Key key{{query.plus_terms, query.minus_terms}, status};
+    const uint64_t index_version = search_server_.GetIndexVersion();
+    optional<vector<Document>> result = cache_->Find(key, index_version);
+    if (!result) {
+        DocumentFilter filter;
+        filter.status = status;
+        shared_ptr<const vector<uint64_t>> cached_allowed;
+        const SearchServer::AllowedDocuments allowed{
+            search_server_.CompileFilter(filter, query, context->allowed_documents, cached_allowed) };
+        result = search_server_.FindAllDocuments(execution::seq, query, allowed, MAX_RESULT_DOCUMENT_COUNT);
+        cache_->Insert(move(key), index_version, *result);
+    }
+    RequestsCount(result->size());
+    return move(*result);
 }
 
 vector<Document> RequestQueue::AddFindRequest(const string_view raw_query) {
@@ -23,6 +44,10 @@ int RequestQueue::GetNoResultRequests() const {
     return empty_count_;
 }
 
+QueryResultCache::Stats RequestQueue::GetCacheStats() const {
+    return cache_->GetStats();
+}
+
 void RequestQueue::RequestsCount(int result){
     if (requests_.size() >= min_in_day_) {
         if (requests_.front().results != 0) {
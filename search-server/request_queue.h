@@ -1,7 +1,9 @@
 #pragma once
 #include <deque>
+#include <memory>
 #include "search_server.h"
 #include "document.h"
+#include "query_result_cache.h"
 
 const int MIN_IN_DAY = 1440;
 
@@ -9,15 +11,21 @@ class RequestQueue {
 public:
 
     explicit RequestQueue(const SearchServer& search_server);
+    // Queues of the same server in different threads may share a cache.
+    RequestQueue(const SearchServer& search_server, std::shared_ptr<QueryResultCache> cache);
 
+    // Requests with a predicate always run the search, since predicates can't be told apart.
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string_view raw_query, DocumentPredicate document_predicate);
+    // Results of requests by status are cached until the next change of the index.
     std::vector<Document> AddFindRequest(const std::string_view raw_query, DocumentStatus status);
     std::vector<Document> AddFindRequest(const std::string_view raw_query);
     int GetNoResultRequests() const;
+    QueryResultCache::Stats GetCacheStats() const;
 
 private:
     const SearchServer& search_server_;
+    std::shared_ptr<QueryResultCache> cache_;
     struct QueryResult {
         int results;
     };
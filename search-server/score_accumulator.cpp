@@ -0,0 +1,24 @@
+#include "score_accumulator.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void ScoreAccumulator::Reset(size_t document_count) {
+    if (scores_.size() < document_count) {
+        scores_.resize(document_count);
+        touched_epoch_.resize(document_count, 0);
+        excluded_epoch_.resize(document_count, 0);
+    }
+    touched_.clear();
+    if (++epoch_ == 0) {
+        fill(touched_epoch_.begin(), touched_epoch_.end(), 0);
+        fill(excluded_epoch_.begin(), excluded_epoch_.end(), 0);
+        epoch_ = 1;
+    }
+}
+
+ScoreAccumulator& ScoreAccumulator::ForCurrentThread() {
+    thread_local ScoreAccumulator accumulator;
+    return accumulator;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense relevance accumulator indexed by document ordinal.
+// Slots are validated by an epoch stamp instead of being cleared, so starting a new query
+// costs O(1) and collecting the result costs O(touched documents).
+class ScoreAccumulator {
+public:
+    // Starts a new query over ordinals [0, document_count).
+    void Reset(size_t document_count);
+
+    void Add(uint32_t document_ordinal, double score) {
+        if (touched_epoch_[document_ordinal] != epoch_) {
+            touched_epoch_[document_ordinal] = epoch_;
+            scores_[document_ordinal] = 0.0;
+            touched_.push_back(document_ordinal);
+        }
+        scores_[document_ordinal] += score;
+    }
+
+    void Exclude(uint32_t document_ordinal) {
+        excluded_epoch_[document_ordinal] = epoch_;
+    }
+
+    bool IsExcluded(uint32_t document_ordinal) const {
+        return excluded_epoch_[document_ordinal] == epoch_;
+    }
+
+    double GetScore(uint32_t document_ordinal) const {
+        return scores_[document_ordinal];
+    }
+
+    // Ordinals that received a score since the last Reset, in order of first touch.
+    const std::vector<uint32_t>& GetTouched() const {
+        return touched_;
+    }
+
+    // Every thread reuses its own accumulator, so queries don't allocate once it has grown.
+    static ScoreAccumulator& ForCurrentThread();
+
+private:
+    std::vector<double> scores_;
+    std::vector<uint32_t> touched_epoch_;
+    std::vector<uint32_t> excluded_epoch_;
+    std::vector<uint32_t> touched_;
+    uint32_t epoch_ = 0;
+};
@@ -1,7 +1,22 @@
 #include "search_server.h"
 
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
 using namespace std;
 
+struct SearchServer::SnapshotState {
+    explicit SnapshotState(const string& path)
+            : snapshot(path) {
+    }
+
+    IndexSnapshot snapshot;
+    mutex word_freqs_mutex;
+    map<int, pmr::map<string_view, double>> word_freqs;
+};
+
 SearchServer::SearchServer(const string& stop_words_text)
         : SearchServer(SplitIntoWords(stop_words_text))
 {
@@ -13,107 +28,663 @@ SearchServer::SearchServer(const string_view stop_words_text)
 }
 
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
+    MaterializeSnapshot();
+    FinishCompaction(false);
+    CheckNewDocumentId(document_id);
+    const auto words = SplitIntoWordsNoStop(document);
+    optional<WordSetFingerprint> fingerprint;
+    if (duplicate_policy_ != DuplicatePolicy::ALLOW) {
+        fingerprint = ComputeFingerprint(words);
+        CheckDuplicate(*fingerprint);
+    }
+    const uint32_t ordinal = static_cast<uint32_t>(ordinal_to_document_id_.size());
+    document_ordinals_.emplace(document_id, ordinal);
+
+    const double inv_word_count = 1.0 / words.size();
+    vector<pair<string_view, uint32_t>> document_words;
+    document_words.reserve(words.size());
+    for (const auto word : words) {
+        const uint32_t term = InternTerm(word);
+        document_words.push_back({ dictionary_.GetWord(term), term });
+    }
+    sort(document_words.begin(), document_words.end());
+
+    auto& word_freqs = document_to_word_freqs_[document_id];
+    for (auto it = document_words.begin(); it != document_words.end();) {
+        const auto run_end = find_if(it, document_words.end(), [word = it->first](const auto& entry) {
+            return entry.first != word;
+        });
+        const auto count = static_cast<uint32_t>(run_end - it);
+        const double term_freq = count * inv_word_count;
+        GetMutablePostings(it->second).Add(ordinal, count, term_freq);
+        ++document_freqs_[it->second];
+        word_freqs.emplace_hint(word_freqs.end(), it->first, term_freq);
+        it = run_end;
+    }
+    ordinal_to_document_id_.push_back(document_id);
+    ratings_.push_back(ComputeAverageRating(ratings));
+    statuses_.push_back(status);
+    inv_word_counts_.push_back(inv_word_count);
+    texts_.push_back(StoreText(document));
+    deleted_ordinals_.resize((ordinal_to_document_id_.size() + 63) / 64);
+    if (fingerprint) {
+        RegisterFingerprint(document_id, *fingerprint);
+    }
+    ++index_epoch_;
+}
+
+void SearchServer::CheckNewDocumentId(int document_id) const {
     if (document_id < 0) {
         throw invalid_argument("id document invalid"s);
     }
-    if (documents_.count(document_id) > 0) {
+    if (document_ordinals_.count(document_id) > 0) {
         throw invalid_argument("document with id already added"s);
     }
+}
 
-    const auto [it, inserted] = documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status, std::string(document) });
-    const auto words = SplitIntoWordsNoStop(it->second.str);
+WordSetFingerprint SearchServer::ComputeFingerprint(vector<string_view> words) {
+    sort(words.begin(), words.end());
+    words.erase(unique(words.begin(), words.end()), words.end());
+    WordSetFingerprint fingerprint;
+    for (const string_view word : words) {
+        fingerprint.Add(word);
+    }
+    return fingerprint;
+}
 
-    const double inv_word_count = 1.0 / words.size();
-    for (const auto word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+void SearchServer::CheckDuplicate(const WordSetFingerprint& fingerprint) const {
+    if (duplicate_policy_ == DuplicatePolicy::REJECT && word_set_documents_.count(fingerprint) > 0) {
+        throw invalid_argument("document with the same words already added"s);
+    }
+}
+
+void SearchServer::RegisterFingerprint(int document_id, const WordSetFingerprint& fingerprint) {
+    vector<int>& document_ids = word_set_documents_[fingerprint];
+    if (!document_ids.empty() && duplicate_policy_ == DuplicatePolicy::REPORT) {
+        duplicate_reports_.push_back({ document_id, document_ids.front() });
+    }
+    document_ids.push_back(document_id);
+}
+
+// Documents of a loaded snapshot are indexed in memory first, which registers them in ordinal order.
+void SearchServer::SetDuplicatePolicy(DuplicatePolicy policy) {
+    if (policy == DuplicatePolicy::ALLOW) {
+        word_set_documents_.clear();
+    } else if (duplicate_policy_ == DuplicatePolicy::ALLOW) {
+        MaterializeSnapshot();
+        const DocumentColumns columns = GetDocumentColumns();
+        for (uint32_t ordinal = 0; ordinal < columns.ordinal_count; ++ordinal) {
+            if (columns.IsDeleted(ordinal)) {
+                continue;
+            }
+            const int document_id = columns.document_ids[ordinal];
+            WordSetFingerprint fingerprint;
+            for (const auto& [word, term_freq] : document_to_word_freqs_.at(document_id)) {
+                fingerprint.Add(word);
+            }
+            word_set_documents_[fingerprint].push_back(document_id);
+        }
+    }
+    duplicate_policy_ = policy;
+}
+
+vector<pair<int, int>> SearchServer::TakeDuplicateReports() {
+    return exchange(duplicate_reports_, {});
+}
+
+// Words of a document are registered in text order, so that merging partial indexes in batch order
+// interns new words in the same order as AddDocument, and are then counted like there.
+void SearchServer::BuildPartialIndex(const vector<const NewDocument*>& batch, PartialIndex& partial) const {
+    vector<pair<string_view, uint32_t>> document_words;
+    vector<string_view> words;
+    for (size_t document = partial.first_document; document < partial.last_document; ++document) {
+        try {
+            SplitIntoWordsNoStop(batch[document]->text, words);
+        } catch (...) {
+            partial.invalid_document = document;
+            partial.error = current_exception();
+            return;
+        }
+
+        document_words.clear();
+        for (const string_view word : words) {
+            const auto [it, inserted] = partial.word_indexes.emplace(word, static_cast<uint32_t>(partial.words.size()));
+            if (inserted) {
+                partial.words.push_back(word);
+                partial.word_postings.emplace_back();
+            }
+            document_words.push_back(*it);
+        }
+        sort(document_words.begin(), document_words.end());
+        if (duplicate_policy_ != DuplicatePolicy::ALLOW) {
+            WordSetFingerprint& fingerprint = partial.fingerprints.emplace_back();
+            for (size_t i = 0; i < document_words.size(); ++i) {
+                if (i == 0 || document_words[i].first != document_words[i - 1].first) {
+                    fingerprint.Add(document_words[i].first);
+                }
+            }
+        }
+
+        auto& word_counts = partial.document_words.emplace_back();
+        for (auto it = document_words.begin(); it != document_words.end();) {
+            const auto run_end = find_if(it, document_words.end(), [word = it->first](const auto& entry) {
+                return entry.first != word;
+            });
+            const auto count = static_cast<uint32_t>(run_end - it);
+            partial.word_postings[it->second].push_back({ static_cast<uint32_t>(document), count });
+            word_counts.push_back({ it->second, count });
+            it = run_end;
+        }
+        partial.inv_word_counts.push_back(1.0 / words.size());
     }
-    document_ids_.insert(document_id);
 }
 
-vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(execution::seq, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
+void SearchServer::AddDocumentBatch(const execution::parallel_policy& policy, const vector<const NewDocument*>& batch) {
+    AddDocumentBatch(policy, batch, max<size_t>(THREADS_COUNT, 1));
+}
+
+void SearchServer::AddDocumentBatch(const execution::sequenced_policy& policy, const vector<const NewDocument*>& batch) {
+    AddDocumentBatch(policy, batch, 1);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::AddDocumentBatch(const ExecutionPolicy& policy, const vector<const NewDocument*>& batch, size_t chunk_count) {
+    FinishCompaction(false);
+    vector<PartialIndex> partials(chunk_count);
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        partials[chunk].first_document = batch.size() * chunk / chunk_count;
+        partials[chunk].last_document = batch.size() * (chunk + 1) / chunk_count;
+    }
+    for_each(policy, partials.begin(), partials.end(), [this, &batch](PartialIndex& partial) {
+        BuildPartialIndex(batch, partial);
+    });
+
+    // The whole batch is checked before anything changes, so a rejected batch leaves the server as it was.
+    // Documents are checked in batch order against the index and the preceding documents of the batch.
+    unordered_set<int> batch_document_ids;
+    unordered_set<WordSetFingerprint, WordSetFingerprint::Hasher> batch_fingerprints;
+    for (const PartialIndex& partial : partials) {
+        for (size_t document = partial.first_document; document < partial.last_document; ++document) {
+            const int document_id = batch[document]->id;
+            CheckNewDocumentId(document_id);
+            if (!batch_document_ids.insert(document_id).second) {
+                throw invalid_argument("document with id already added"s);
+            }
+            if (document == partial.invalid_document) {
+                rethrow_exception(partial.error);
+            }
+            if (duplicate_policy_ == DuplicatePolicy::REJECT) {
+                const WordSetFingerprint& fingerprint = partial.fingerprints[document - partial.first_document];
+                CheckDuplicate(fingerprint);
+                if (!batch_fingerprints.insert(fingerprint).second) {
+                    throw invalid_argument("document with the same words already added"s);
+                }
+            }
+        }
+    }
+
+    const uint32_t first_ordinal = static_cast<uint32_t>(ordinal_to_document_id_.size());
+    for (const PartialIndex& partial : partials) {
+        for (size_t document = partial.first_document; document < partial.last_document; ++document) {
+            const int document_id = batch[document]->id;
+            if (duplicate_policy_ != DuplicatePolicy::ALLOW) {
+                RegisterFingerprint(document_id, partial.fingerprints[document - partial.first_document]);
+            }
+            document_ordinals_.emplace(document_id, static_cast<uint32_t>(first_ordinal + document));
+        }
+    }
+
+    // Every posting list is appended to by one task, taking partial indexes in batch order.
+    unordered_map<uint32_t, size_t> term_indexes;
+    vector<uint32_t> terms;
+    vector<vector<pair<PartialIndex*, uint32_t>>> term_sources;
+    for (PartialIndex& partial : partials) {
+        partial.terms.resize(partial.words.size());
+        for (uint32_t word_index = 0; word_index < partial.words.size(); ++word_index) {
+            const uint32_t term = InternTerm(partial.words[word_index]);
+            partial.terms[word_index] = term;
+            const auto [it, inserted] = term_indexes.emplace(term, terms.size());
+            if (inserted) {
+                terms.push_back(term);
+                term_sources.emplace_back();
+            }
+            term_sources[it->second].push_back({ &partial, word_index });
+        }
+    }
+    vector<size_t> term_order(terms.size());
+    iota(term_order.begin(), term_order.end(), 0);
+    for_each(policy, term_order.begin(), term_order.end(), [this, &terms, &term_sources, first_ordinal](size_t term) {
+        PostingList& postings = GetMutablePostings(terms[term]);
+        for (const auto& [partial, word_index] : term_sources[term]) {
+            for (const auto& [document, count] : partial->word_postings[word_index]) {
+                const double term_freq = count * partial->inv_word_counts[document - partial->first_document];
+                postings.Add(static_cast<uint32_t>(first_ordinal + document), count, term_freq);
+                ++document_freqs_[terms[term]];
+            }
+        }
     });
+
+    // Word frequency maps take their nodes from the shared pool, so they are filled in sequentially.
+    for (const PartialIndex& partial : partials) {
+        for (size_t document = partial.first_document; document < partial.last_document; ++document) {
+            const NewDocument& new_document = *batch[document];
+            const int document_id = new_document.id;
+            const size_t local_document = document - partial.first_document;
+            const double inv_word_count = partial.inv_word_counts[local_document];
+            auto& word_freqs = document_to_word_freqs_[document_id];
+            for (const auto& [word_index, count] : partial.document_words[local_document]) {
+                word_freqs.emplace_hint(word_freqs.end(), dictionary_.GetWord(partial.terms[word_index]), count * inv_word_count);
+            }
+            ordinal_to_document_id_.push_back(document_id);
+            ratings_.push_back(ComputeAverageRating(new_document.ratings));
+            statuses_.push_back(new_document.status);
+            inv_word_counts_.push_back(inv_word_count);
+            texts_.push_back(StoreText(new_document.text));
+        }
+    }
+
+    if (!batch.empty()) {
+        deleted_ordinals_.resize((ordinal_to_document_id_.size() + 63) / 64);
+        ++index_epoch_;
+    }
+}
+
+vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status, size_t max_document_count) const {
+    return FindTopDocuments(execution::seq, raw_query, status, max_document_count);
 }
 
 vector<Document> SearchServer::FindTopDocuments(const string_view raw_query) const {
     return FindTopDocuments(execution::seq, raw_query, DocumentStatus::ACTUAL);
 }
 
+vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, const DocumentFilter& filter, size_t max_document_count) const {
+    return FindTopDocuments(execution::seq, raw_query, filter, max_document_count);
+}
+
+void SearchServer::ClearDeleted(const DocumentColumns& columns, vector<uint64_t>& allowed) {
+    if (columns.deleted == nullptr) {
+        return;
+    }
+    for (size_t word = 0; word < allowed.size(); ++word) {
+        allowed[word] &= ~columns.deleted[word];
+    }
+}
+
+// Two queries may compile a missing status bitmap at the same time; both get the same bits.
+// A cached bitmap has the documents removed from this server cleared; those removed from a
+// segment by the query are cleared in a copy.
+const uint64_t* SearchServer::CompileFilter(const DocumentFilter& filter, const Query& query, vector<uint64_t>& allowed_documents,
+                                            shared_ptr<const vector<uint64_t>>& cached_allowed) const {
+    const DocumentColumns columns = GetDocumentColumns(query);
+    if (!filter.HasStatusOnly()) {
+        CompileDocumentFilter(filter, columns.document_ids, columns.statuses, columns.ratings, columns.ordinal_count,
+                              allowed_documents);
+        ClearDeleted(columns, allowed_documents);
+        return allowed_documents.data();
+    }
+    StatusFilter& status_filter = status_filters_->filters[static_cast<size_t>(*filter.status)];
+    {
+        lock_guard guard(status_filters_->mutex);
+        if (status_filter.epoch == index_epoch_) {
+            cached_allowed = status_filter.allowed;
+        }
+    }
+    if (!cached_allowed) {
+        const DocumentColumns server_columns = GetDocumentColumns();
+        auto allowed = make_shared<vector<uint64_t>>();
+        CompileDocumentFilter(filter, server_columns.document_ids, server_columns.statuses, server_columns.ratings,
+                              server_columns.ordinal_count, *allowed);
+        ClearDeleted(server_columns, *allowed);
+        cached_allowed = allowed;
+        lock_guard guard(status_filters_->mutex);
+        status_filter = { index_epoch_, move(allowed) };
+    }
+    if (query.deleted == nullptr) {
+        return cached_allowed->data();
+    }
+    allowed_documents.assign(cached_allowed->begin(), cached_allowed->end());
+    ClearDeleted(columns, allowed_documents);
+    return allowed_documents.data();
+}
+
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    if (snapshot_) {
+        return snapshot_->snapshot.GetDocumentCount();
+    }
+    return document_ordinals_.size();
+}
+
+SearchServer::QueryKey SearchServer::GetQueryKey(const string_view raw_query) const {
+    Query query = ParseQuery(raw_query);
+    return { move(query.plus_terms), move(query.minus_terms) };
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static const map<string_view, double> empty_map;
+uint64_t SearchServer::GetIndexVersion() const {
+    return index_epoch_;
+}
+
+// A snapshot has no forward index: frequencies of a document are counted from its text on demand.
+const pmr::map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
+    static const pmr::map<string_view, double> empty_map;
+    if (snapshot_) {
+        const auto ordinal = snapshot_->snapshot.FindDocument(document_id);
+        if (!ordinal) {
+            return empty_map;
+        }
+        lock_guard guard(snapshot_->word_freqs_mutex);
+        const auto [it, inserted] = snapshot_->word_freqs.try_emplace(document_id);
+        if (inserted) {
+            const auto words = SplitIntoWordsNoStop(snapshot_->snapshot.GetDocumentText(*ordinal));
+            for (const string_view word : words) {
+                ++it->second[word];
+            }
+            const double inv_word_count = snapshot_->snapshot.GetInvWordCounts()[*ordinal];
+            for (auto& [word, freq] : it->second) {
+                freq *= inv_word_count;
+            }
+        }
+        return it->second;
+    }
     if (document_to_word_freqs_.count(document_id) == 0) {
         return empty_map;
     }
     return document_to_word_freqs_.at(document_id);
 }
 
-void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
-    if (documents_.count(document_id) != 0) {
-        for (auto& word : document_to_word_freqs_[document_id]) {
-            word_to_document_freqs_[word.first].erase(document_id);
+void SearchServer::GetDocumentTerms(int document_id, vector<uint32_t>& terms) const {
+    terms.clear();
+    for (const auto& [word, freq] : GetWordFrequencies(document_id)) {
+        terms.push_back(*FindTerm(word));
+    }
+    sort(terms.begin(), terms.end());
+}
+
+void SearchServer::SaveSnapshot(const string& path) const {
+    if (snapshot_) {
+        snapshot_->snapshot.Save(path);
+        return;
+    }
+
+    // Removed documents leave gaps in the ordinals, which the snapshot doesn't keep.
+    const uint32_t ordinal_count = static_cast<uint32_t>(ordinal_to_document_id_.size());
+    vector<uint32_t> new_ordinals(ordinal_count, UINT32_MAX);
+    vector<SnapshotDocument> documents;
+    documents.reserve(document_ordinals_.size());
+    for (uint32_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        if (deleted_ordinals_[ordinal / 64] >> (ordinal % 64) & 1) {
+            continue;
         }
-        documents_.erase(document_id);
-        document_ids_.erase(document_id);
-        document_to_word_freqs_.erase(document_id);
+        new_ordinals[ordinal] = static_cast<uint32_t>(documents.size());
+        documents.push_back({ ordinal_to_document_id_[ordinal], ratings_[ordinal], statuses_[ordinal], inv_word_counts_[ordinal], texts_[ordinal] });
     }
+
+    deque<PostingList> renumbered_postings;
+    vector<pair<string_view, PostingListView>> terms;
+    terms.reserve(postings_.size());
+    for (uint32_t term = 0; term < postings_.size(); ++term) {
+        const string_view word = dictionary_.GetWord(term);
+        const PostingList& postings = *postings_[term];
+        if (postings.empty()) {
+            continue;
+        }
+        if (documents.size() == ordinal_count) {
+            terms.push_back({ word, postings.GetView() });
+            continue;
+        }
+        if (document_freqs_[term] == 0) {
+            continue;
+        }
+        PostingList& renumbered = renumbered_postings.emplace_back();
+        for (auto cursor = postings.GetCursor(); !cursor.AtEnd(); cursor.Next()) {
+            const uint32_t ordinal = cursor.GetOrdinal();
+            if (new_ordinals[ordinal] == UINT32_MAX) {
+                continue;
+            }
+            renumbered.Add(new_ordinals[ordinal], cursor.GetCount(), cursor.GetCount() * inv_word_counts_[ordinal]);
+        }
+        terms.push_back({ word, renumbered.GetView() });
+    }
+
+    const vector<string_view> stop_words(stop_words_.begin(), stop_words_.end());
+    WriteIndexSnapshot(path, stop_words, terms, documents);
 }
 
-void SearchServer::RemoveDocument(const execution::parallel_policy&, int document_id) {
-    if (document_ids_.count(document_id) != 0) {
-        documents_.erase(document_id);
-        document_ids_.erase(document_id);
-        for_each(
-            execution::par,
-            word_to_document_freqs_.begin(), word_to_document_freqs_.end(),
-            [document_id](auto& document) {document.second.erase(document_id); });
-        document_to_word_freqs_.erase(document_id);
+SearchServer SearchServer::LoadSnapshot(const string& path) {
+    auto state = make_shared<SnapshotState>(path);
+    SearchServer search_server(state->snapshot.GetStopWords());
+    search_server.snapshot_ = move(state);
+    return search_server;
+}
+
+// Documents are added back in ordinal order, which reproduces the postings of the snapshot.
+void SearchServer::MaterializeSnapshot() {
+    if (!snapshot_) {
+        return;
+    }
+    const shared_ptr<SnapshotState> state = move(snapshot_);
+    const IndexSnapshot& snapshot = state->snapshot;
+    const int* document_ids = snapshot.GetDocumentIds();
+    const int* ratings = snapshot.GetRatings();
+    const DocumentStatus* statuses = snapshot.GetStatuses();
+    vector<NewDocument> documents;
+    documents.reserve(snapshot.GetDocumentCount());
+    for (uint32_t ordinal = 0; ordinal < snapshot.GetDocumentCount(); ++ordinal) {
+        documents.push_back({ document_ids[ordinal], snapshot.GetDocumentText(ordinal), statuses[ordinal], { ratings[ordinal] } });
+    }
+    AddDocuments(execution::par, documents);
+}
+
+SearchServer::DocumentColumns SearchServer::GetDocumentColumns() const {
+    if (snapshot_) {
+        const IndexSnapshot& snapshot = snapshot_->snapshot;
+        return { snapshot.GetDocumentIds(), snapshot.GetRatings(), snapshot.GetStatuses(), snapshot.GetInvWordCounts(),
+                 nullptr, snapshot.GetDocumentCount() };
+    }
+    return { ordinal_to_document_id_.data(), ratings_.data(), statuses_.data(), inv_word_counts_.data(),
+             deleted_ordinals_.data(), static_cast<uint32_t>(ordinal_to_document_id_.size()) };
+}
+
+SearchServer::DocumentColumns SearchServer::GetDocumentColumns(const Query& query) const {
+    DocumentColumns columns = GetDocumentColumns();
+    if (query.deleted != nullptr) {
+        columns.deleted = query.deleted;
     }
+    return columns;
+}
 
+optional<uint32_t> SearchServer::FindDocumentOrdinal(int document_id) const {
+    if (snapshot_) {
+        return snapshot_->snapshot.FindDocument(document_id);
+    }
+    const auto document_it = document_ordinals_.find(document_id);
+    if (document_it == document_ordinals_.end()) {
+        return nullopt;
+    }
+    return document_it->second;
+}
+
+void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy, int document_id) {
+    RemoveDocumentBatch(policy, { document_id });
+}
+
+void SearchServer::RemoveDocument(const execution::parallel_policy& policy, int document_id) {
+    RemoveDocumentBatch(policy, { document_id });
 }
 
 void SearchServer::RemoveDocument(int document_id) {
     RemoveDocument(std::execution::seq, document_id);
 }
 
-set<int>::const_iterator SearchServer::begin() const {
-    return document_ids_.begin();
+void SearchServer::RemoveDocumentBatch(const execution::parallel_policy& policy, const vector<int>& document_ids) {
+    FinishCompaction(false);
+    DetachDocuments(document_ids);
+    if (!compaction_.valid() && pending_document_count_ >= max(MIN_COMPACTION_DOCUMENT_COUNT, document_ordinals_.size() / 8)) {
+        StartCompaction(policy);
+    }
+}
+
+void SearchServer::RemoveDocumentBatch(const execution::sequenced_policy& policy, const vector<int>& document_ids) {
+    FinishCompaction(false);
+    DetachDocuments(document_ids);
+    if (!compaction_.valid() && pending_document_count_ >= max(MIN_COMPACTION_DOCUMENT_COUNT, document_ordinals_.size() / 8)) {
+        StartCompaction(policy);
+    }
+}
+
+void SearchServer::CompactDeletedDocuments() {
+    FinishCompaction(true);
+    if (!pending_erasures_.empty()) {
+        StartCompaction(execution::par);
+        FinishCompaction(true);
+    }
+}
+
+// The terms of a document are the keys of its word frequencies, so removal never looks at other terms.
+void SearchServer::DetachDocuments(const vector<int>& document_ids) {
+    if (any_of(document_ids.begin(), document_ids.end(), [this](int document_id) {
+            return FindDocumentOrdinal(document_id).has_value();
+        })) {
+        MaterializeSnapshot();
+    }
+    for (const int document_id : document_ids) {
+        const auto document_it = document_ordinals_.find(document_id);
+        if (document_it == document_ordinals_.end()) {
+            continue;
+        }
+        const uint32_t ordinal = document_it->second;
+        const auto word_freqs_it = document_to_word_freqs_.find(document_id);
+        for (const auto& [word, term_freq] : word_freqs_it->second) {
+            const uint32_t term = *dictionary_.Find(word);
+            --document_freqs_[term];
+            pending_erasures_.push_back({ term, ordinal });
+        }
+        if (duplicate_policy_ != DuplicatePolicy::ALLOW) {
+            WordSetFingerprint fingerprint;
+            for (const auto& [word, term_freq] : word_freqs_it->second) {
+                fingerprint.Add(word);
+            }
+            const auto group_it = word_set_documents_.find(fingerprint);
+            vector<int>& group = group_it->second;
+            group.erase(find(group.begin(), group.end(), document_id));
+            if (group.empty()) {
+                word_set_documents_.erase(group_it);
+            }
+        }
+        deleted_ordinals_[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+        ++pending_document_count_;
+        document_ordinals_.erase(document_it);
+        document_to_word_freqs_.erase(word_freqs_it);
+        ++index_epoch_;
+    }
+}
+
+// The task shares the affected posting lists and copies them itself, so the removal that starts
+// it only collects the lists, and queries and changes of the index go on while it runs.
+template <typename ExecutionPolicy>
+void SearchServer::StartCompaction(const ExecutionPolicy& policy) {
+    vector<pair<uint32_t, uint32_t>> term_ordinals = move(pending_erasures_);
+    pending_erasures_.clear();
+    pending_document_count_ = 0;
+
+    vector<uint8_t> is_affected(postings_.size());
+    vector<pair<uint32_t, shared_ptr<const PostingList>>> sources;
+    for (const auto& [term, ordinal] : term_ordinals) {
+        if (!is_affected[term]) {
+            is_affected[term] = 1;
+            sources.push_back({ term, postings_[term] });
+        }
+    }
+    compaction_ordinal_count_ = static_cast<uint32_t>(ordinal_to_document_id_.size());
+
+    compaction_ = async(launch::async, [policy, sources = move(sources), term_ordinals = move(term_ordinals)]() mutable {
+        sort(sources.begin(), sources.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+        });
+        sort(term_ordinals.begin(), term_ordinals.end());
+        vector<size_t> run_starts;
+        for (size_t i = 0; i < term_ordinals.size(); ++i) {
+            if (i == 0 || term_ordinals[i].first != term_ordinals[i - 1].first) {
+                run_starts.push_back(i);
+            }
+        }
+        run_starts.push_back(term_ordinals.size());
+        vector<uint32_t> ordinals(term_ordinals.size());
+        transform(term_ordinals.begin(), term_ordinals.end(), ordinals.begin(), [](const auto& entry) {
+            return entry.second;
+        });
+
+        vector<CompactedPostings> compacted(sources.size());
+        vector<size_t> runs(sources.size());
+        iota(runs.begin(), runs.end(), 0);
+        for_each(policy, runs.begin(), runs.end(), [&compacted, &sources, &ordinals, &run_starts](size_t run) {
+            compacted[run] = { sources[run].first, *sources[run].second };
+            // Lets the writer change the list in place again.
+            sources[run].second.reset();
+            compacted[run].postings.Erase(ordinals.data() + run_starts[run], ordinals.data() + run_starts[run + 1]);
+        });
+        return compacted;
+    });
 }
-set<int>::const_iterator SearchServer::end() const {
-    return document_ids_.end();
+
+void SearchServer::FinishCompaction(bool wait) {
+    if (!compaction_.valid() || (!wait && compaction_.wait_for(chrono::seconds(0)) != future_status::ready)) {
+        return;
+    }
+    vector<CompactedPostings> compacted = compaction_.get();
+    for (auto& [term, postings] : compacted) {
+        const PostingList& current = *postings_[term];
+        for (auto cursor = current.LowerBound(compaction_ordinal_count_); !cursor.AtEnd(); cursor.Next()) {
+            const uint32_t ordinal = cursor.GetOrdinal();
+            postings.Add(ordinal, cursor.GetCount(), cursor.GetCount() * inv_word_counts_[ordinal]);
+        }
+        postings_[term] = make_shared<PostingList>(move(postings));
+        if (postings_[term]->empty()) {
+            ReleaseTerm(term);
+        }
+    }
+    // Posting positions have changed, so precomputed impacts no longer apply.
+    ++index_epoch_;
+}
+
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    if (snapshot_) {
+        return DocumentIdIterator(snapshot_->snapshot.GetIdIndex());
+    }
+    return DocumentIdIterator(document_ordinals_.begin());
+}
+
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    if (snapshot_) {
+        return DocumentIdIterator(snapshot_->snapshot.GetIdIndex() + snapshot_->snapshot.GetDocumentCount());
+    }
+    return DocumentIdIterator(document_ordinals_.end());
 }
 
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
-    if (!document_ids_.count(document_id)) {
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    if (!ordinal) {
         throw std::out_of_range("incorrect document_id");
     }
-    const Query query = ParseQuery(raw_query);
+    const QueryContextLease context;
+    ParseQuery(raw_query, false, *context);
+    const Query& query = context->query;
+    const DocumentStatus status = GetDocumentColumns().statuses[*ordinal];
  
-    for (const std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return { {}, documents_.at(document_id).status };
+    for (const uint32_t term : query.minus_terms) {
+        if (GetPostings(term).Contains(*ordinal)) {
+            return { std::vector<std::string_view>{}, status };
         }
     }
     std::vector<std::string_view> matched_words;
+    matched_words.reserve(query.plus_terms.size());
  
-    for (const std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
+    for (const uint32_t term : query.plus_terms) {
+        if (GetPostings(term).Contains(*ordinal)) {
+            matched_words.push_back(GetTermWord(term));
         }
     }
-    return { matched_words, documents_.at(document_id).status };
+    return { move(matched_words), status };
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const string_view raw_query, int document_id) const {
@@ -121,35 +692,54 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const str
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const execution::parallel_policy&, const string_view raw_query, int document_id) const {
-    const auto query = ParseQuery(raw_query, true);
+    const QueryContextLease context;
+    ParseQuery(raw_query, true, *context);
+    const Query& query = context->query;
 
-    const auto status = documents_.at(document_id).status;
+    const auto ordinal = FindDocumentOrdinal(document_id);
+    if (!ordinal) {
+        throw std::out_of_range("incorrect document_id");
+    }
+    const auto status = GetDocumentColumns().statuses[*ordinal];
 
-    const auto word_checker =
-            [this, document_id](const string_view word) {
-                const auto it = word_to_document_freqs_.find(word);
-                return it != word_to_document_freqs_.end() && it->second.count(document_id);
+    const auto term_checker =
+            [this, ordinal = *ordinal](const uint32_t term) {
+                return GetPostings(term).Contains(ordinal);
             };
-    if (any_of(execution::par, query.minus_words.begin(), query.minus_words.end(), word_checker)) {
-        return { {}, status };
+    if (any_of(execution::par, query.minus_terms.begin(), query.minus_terms.end(), term_checker)) {
+        return { vector<string_view>{}, status };
     }
 
-    vector<string_view> matched_words(query.plus_words.size());
-    auto words_end = copy_if(
+    vector<uint32_t>& matched_terms = context->matched_terms;
+    matched_terms.resize(query.plus_terms.size());
+    auto terms_end = copy_if(
             execution::par,
-            query.plus_words.begin(), query.plus_words.end(),
-            matched_words.begin(),
-            word_checker
+            query.plus_terms.begin(), query.plus_terms.end(),
+            matched_terms.begin(),
+            term_checker
     );
-    sort(matched_words.begin(), words_end);
-    words_end = unique(matched_words.begin(), words_end);
-    matched_words.erase(words_end, matched_words.end());
+    vector<string_view> matched_words;
+    matched_words.reserve(terms_end - matched_terms.begin());
+    for (auto it = matched_terms.begin(); it != terms_end; ++it) {
+        matched_words.push_back(GetTermWord(*it));
+    }
+    sort(matched_words.begin(), matched_words.end());
+    matched_words.erase(unique(matched_words.begin(), matched_words.end()), matched_words.end());
 
-    return { matched_words, status };
+    return { move(matched_words), status };
+}
+
+string_view SearchServer::StoreText(string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    char* data = static_cast<char*>(memory_->arena.allocate(text.size(), 1));
+    copy(text.begin(), text.end(), data);
+    return { data, text.size() };
 }
 
 bool SearchServer::IsStopWord(string_view word) const {
-    return stop_words_.count(word) > 0;
+    return stop_word_set_.Contains(word);
 }
 
 bool SearchServer::IsValidWord(const string_view word) {
@@ -160,17 +750,16 @@ bool SearchServer::IsValidWord(const string_view word) {
 
 vector<string_view> SearchServer::SplitIntoWordsNoStop(const string_view text) const {
     vector<string_view> words;
-    for (const string_view word : SplitIntoWordsView(text)) {
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word is invalid"s);
-        }
-        if (!IsStopWord(word) && word != ""s) {
-            words.push_back(word);
-        }
-    }
+    SplitIntoWordsNoStop(text, words);
     return words;
 }
 
+void SearchServer::SplitIntoWordsNoStop(const string_view text, vector<string_view>& words) const {
+    if (!SplitIntoValidWordsView(text, words, stop_word_set_)) {
+        throw std::invalid_argument("Word is invalid"s);
+    }
+}
+
 int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     if (ratings.empty()) {
         return 0;
@@ -178,32 +767,71 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return accumulate(ratings.begin(), ratings.end(), 0) / static_cast<int>(ratings.size());
 }
 
-SearchServer::Query SearchServer::ParseQuery(const string_view text, bool skip_sort) const {
-    Query result;
-    for (const string_view word : SplitIntoWordsView(text)) {
+// Words are resolved to term ids once here, after sorting, so plus terms keep the order of their
+// text. Words that aren't indexed can't match anything and are dropped.
+void SearchServer::ParseQuery(const string_view text, bool skip_sort, QueryContext& context) const {
+    SplitIntoWordsView(text, context.words);
+    context.plus_words.clear();
+    context.minus_words.clear();
+    for (const string_view word : context.words) {
         const auto query_word = ParseQueryWord(word);
         if (!query_word.is_stop) {
             if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
+                context.minus_words.push_back(query_word.data);
             }
             else {
-                result.plus_words.push_back(query_word.data);
+                context.plus_words.push_back(query_word.data);
             }
         }
     }
-    if (!skip_sort) {
-        for (auto* words : { &result.plus_words, &result.minus_words }) {
+    Query& result = context.query;
+    result.plus_terms.clear();
+    result.minus_terms.clear();
+    result.inverse_document_freqs.clear();
+    result.deleted = nullptr;
+    for (auto [words, terms] : { pair{ &context.plus_words, &result.plus_terms }, pair{ &context.minus_words, &result.minus_terms } }) {
+        if (!skip_sort) {
             sort(words->begin(), words->end());
             words->erase(unique(words->begin(), words->end()), words->end());
         }
+        for (const string_view word : *words) {
+            if (const auto term = FindTerm(word)) {
+                terms->push_back(*term);
+            }
+        }
     }
-    return result;
+}
+
+SearchServer::Query SearchServer::ParseQuery(const string_view text, bool skip_sort) const {
+    const QueryContextLease context;
+    ParseQuery(text, skip_sort, *context);
+    return context->query;
 }
 
 SearchServer::Query SearchServer::ParseQuery(const string_view text) const {
     return ParseQuery(text, false);
 }
 
+SearchServer::QueryContextLease::QueryContextLease()
+        : context_(Acquire()) {
+}
+
+SearchServer::QueryContextLease::~QueryContextLease() {
+    --GetPool().leased_count;
+}
+
+SearchServer::QueryContextLease::Pool& SearchServer::QueryContextLease::GetPool() {
+    thread_local Pool pool;
+    return pool;
+}
+
+SearchServer::QueryContext& SearchServer::QueryContextLease::Acquire() {
+    Pool& pool = GetPool();
+    if (pool.leased_count == pool.contexts.size()) {
+        pool.contexts.push_back(make_unique<QueryContext>());
+    }
+    return *pool.contexts[pool.leased_count++];
+}
 
 SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
     if (text.empty()) {
@@ -221,6 +849,115 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
     return { text, is_minus, minus };
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
-}
\ No newline at end of file
+double SearchServer::ComputeWordInverseDocumentFreq(size_t document_freq) const {
+    return log(GetDocumentCount() * 1.0 / document_freq);
+}
+
+size_t SearchServer::GetDocumentFreq(uint32_t term, const PostingListView& postings) const {
+    if (snapshot_) {
+        return postings.size();
+    }
+    return document_freqs_[term];
+}
+
+double SearchServer::GetInverseDocumentFreq(uint32_t term, const PostingListView& postings) const {
+    if (snapshot_) {
+        return ComputeWordInverseDocumentFreq(postings.size());
+    }
+    CachedInverseDocumentFreq& cached = inverse_document_freqs_[term];
+    if (cached.epoch.load(memory_order_acquire) == index_epoch_) {
+        return cached.value.load(memory_order_relaxed);
+    }
+    const double inverse_document_freq = ComputeWordInverseDocumentFreq(document_freqs_[term]);
+    cached.value.store(inverse_document_freq, memory_order_relaxed);
+    cached.epoch.store(index_epoch_, memory_order_release);
+    return inverse_document_freq;
+}
+
+const double* SearchServer::GetImpacts(uint32_t term) const {
+    if (snapshot_ || impacts_epoch_ != index_epoch_) {
+        return nullptr;
+    }
+    return impacts_[term].data();
+}
+
+// An impact is computed exactly like the score added during evaluation, so results don't change.
+void SearchServer::PrecomputeImpacts() {
+    if (snapshot_) {
+        return;
+    }
+    impacts_.resize(postings_.size());
+    vector<uint32_t> terms(postings_.size());
+    iota(terms.begin(), terms.end(), 0);
+    for_each(execution::par, terms.begin(), terms.end(), [this](uint32_t term) {
+        const PostingListView postings = postings_[term]->GetView();
+        const double inverse_document_freq = GetInverseDocumentFreq(term, postings);
+        vector<double>& impacts = impacts_[term];
+        impacts.assign(postings.GetBlockCount() * PostingListView::BLOCK_SIZE, 0.0);
+        for (auto cursor = postings.GetCursor(); !cursor.AtEnd(); cursor.Next()) {
+            const double term_freq = cursor.GetCount() * inv_word_counts_[cursor.GetOrdinal()];
+            impacts[cursor.GetPosition()] = term_freq * inverse_document_freq;
+        }
+    });
+    impacts_epoch_ = index_epoch_;
+}
+
+void SearchServer::CollectTopDocuments(const ScoreAccumulator& accumulator, const DocumentColumns& columns,
+                                       TopDocuments& top_documents) const {
+    for (const uint32_t document_ordinal : accumulator.GetTouched()) {
+        top_documents.Push({ columns.document_ids[document_ordinal], accumulator.GetScore(document_ordinal),
+                             columns.ratings[document_ordinal] });
+    }
+}
+
+uint32_t SearchServer::InternTerm(const string_view word) {
+    if (const auto term = dictionary_.Find(word)) {
+        return *term;
+    }
+    const uint32_t term = dictionary_.Insert(StoreText(word));
+    if (term == postings_.size()) {
+        postings_.push_back(make_shared<PostingList>());
+        document_freqs_.push_back(0);
+        inverse_document_freqs_.emplace_back();
+    }
+    return term;
+}
+
+void SearchServer::ReleaseTerm(uint32_t term) {
+    postings_[term] = make_shared<PostingList>();
+    if (term < impacts_.size()) {
+        impacts_[term] = vector<double>();
+    }
+    dictionary_.Erase(term);
+}
+
+optional<uint32_t> SearchServer::FindTerm(const string_view word) const {
+    if (snapshot_) {
+        return snapshot_->snapshot.FindTerm(word);
+    }
+    return dictionary_.Find(word);
+}
+
+string_view SearchServer::GetTermWord(uint32_t term) const {
+    if (snapshot_) {
+        return snapshot_->snapshot.GetTermWord(term);
+    }
+    return dictionary_.GetWord(term);
+}
+
+PostingListView SearchServer::GetPostings(uint32_t term) const {
+    if (snapshot_) {
+        return snapshot_->snapshot.GetPostings(term);
+    }
+    return postings_[term]->GetView();
+}
+
+// Only the writer copies or replaces the pointers; a compaction that still holds the list
+// only reads it.
+PostingList& SearchServer::GetMutablePostings(uint32_t term) {
+    shared_ptr<PostingList>& postings = postings_[term];
+    if (postings.use_count() > 1) {
+        postings = make_shared<PostingList>(*postings);
+    }
+    return *postings;
+}
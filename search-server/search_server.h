@@ -6,15 +6,38 @@
 #include <vector>
 #include <numeric>
 #include <execution>
+#include <iterator>
 #include <string_view>
 #include <thread>
+#include <memory_resource>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <exception>
+#include <cstdint>
+#include <memory>
+#include <future>
+#include <optional>
+#include <set>
+#include <mutex>
+#include <array>
 
-#include "concurrent_map.h"
 #include "document.h"
+#include "document_filter.h"
+#include "index_snapshot.h"
+#include "posting_list.h"
+#include "pruning_policy.h"
+#include "score_accumulator.h"
+#include "stop_word_set.h"
 #include "string_processing.h"
+#include "task_scheduler.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
+#include "word_set_fingerprint.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const double EPSILON = 1e-6;
+// Ordinals scored at a time by pruning::wand before the bounds of their documents are checked.
+const uint32_t WAND_WINDOW_SIZE = 1024;
 const size_t THREADS_COUNT = std::thread::hardware_concurrency();
 
 class SearchServer {
@@ -28,28 +51,98 @@ public:
 
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Indexes a range of NewDocument with the same result as calling AddDocument for each of them
+    // in order. If any of them would be rejected, the exception AddDocument would throw for the first
+    // such document is thrown and none of the batch is indexed.
+    // With std::execution::par documents are tokenized into per-thread partial indexes merged at the end.
+    template <typename ExecutionPolicy, typename DocumentRange>
+    void AddDocuments(const ExecutionPolicy& policy, const DocumentRange& documents);
+
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const;
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
     std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
 
     template <typename ExecutionPolicy, typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query) const;
 
+    // The filter is turned into a bitmap of documents before scoring, which then tests one bit
+    // per posting. Bitmaps of status filters, which the status overloads use, are kept until
+    // the index changes.
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, const DocumentFilter& filter,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, const DocumentFilter& filter,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
     int GetDocumentCount() const;
+
+    // Distinct indexed plus and minus words of a query as term ids. Queries with equal keys find
+    // the same documents as long as GetIndexVersion() stays the same. Throws on invalid queries
+    // like FindTopDocuments.
+    struct QueryKey {
+        std::vector<uint32_t> plus_terms;
+        std::vector<uint32_t> minus_terms;
+
+        bool operator==(const QueryKey& other) const {
+            return plus_terms == other.plus_terms && minus_terms == other.minus_terms;
+        }
+    };
+
+    QueryKey GetQueryKey(const std::string_view raw_query) const;
+    // Changes whenever a document is added or removed.
+    uint64_t GetIndexVersion() const;
     
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    const std::pmr::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    // Replaces the contents of terms with the distinct term ids of the document's words, sorted;
+    // leaves it empty for an unknown id. Documents with equal term sets have the same words.
+    void GetDocumentTerms(int document_id, std::vector<uint32_t>& terms) const;
     
+    // Writes the index to a versioned binary file that LoadSnapshot maps back.
+    void SaveSnapshot(const std::string& path) const;
+    // Queries run straight off the mapped file, so loading doesn't depend on the corpus size.
+    // The first change to the loaded server rebuilds the index in memory from the snapshot.
+    static SearchServer LoadSnapshot(const std::string& path);
+
+    // Stores the tf-idf of every posting so that scoring reads one number per posting.
+    // Impacts take 8 bytes a posting and are ignored after the next change of the index,
+    // so they pay off for indexes that are queried much more often than updated.
+    void PrecomputeImpacts();
+
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::parallel_policy&, int document_id);
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
+
+    // Removes the documents with the given ids, skipping unknown ones.
+    template <typename ExecutionPolicy, typename DocumentIdRange>
+    void RemoveDocuments(const ExecutionPolicy& policy, const DocumentIdRange& document_ids);
+
+    // Removal only marks a document deleted, and queries skip it. Once enough documents are removed,
+    // a background task erases their postings, which is swapped in by a later change of the index;
+    // the policy of the removal that starts it is used to rewrite the posting lists.
+    // Waits for that task and erases the postings of all removed documents.
+    void CompactDeletedDocuments();
+
+    // Detection keeps a fingerprint of the words of every document, so that a duplicate is found
+    // with a hash lookup when it is added, before anything is indexed. Turning it on registers
+    // the indexed documents without reporting duplicates among them; ALLOW turns it off.
+    void SetDuplicatePolicy(DuplicatePolicy policy);
+    // Documents added under DuplicatePolicy::REPORT with the same words as an indexed document,
+    // as (id, id of the earliest such document) in order of addition; the reports are cleared.
+    std::vector<std::pair<int, int>> TakeDuplicateReports();
     
-    std::set<int>::const_iterator begin() const;
-    std::set<int>::const_iterator end() const;
+    // Ids of the documents in ascending order.
+    class DocumentIdIterator;
+    DocumentIdIterator begin() const;
+    DocumentIdIterator end() const;
     
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, const std::string_view raw_query, int document_id) const;
@@ -58,23 +151,169 @@ public:
     
     
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
-        std::string str;
+    // Runs queries on servers it uses as index segments, with statistics of the whole index.
+    friend class SegmentedSearchServer;
+    // Keys its cache by the parsed query and searches with the same one.
+    friend class RequestQueue;
+
+    // Document attributes indexed by ordinal, read either from the vectors below or from a snapshot.
+    struct DocumentColumns {
+        const int* document_ids;
+        const int* ratings;
+        const DocumentStatus* statuses;
+        const double* inv_word_counts;
+        // Bitmap of removed ordinals whose postings are not erased yet, or nullptr.
+        const uint64_t* deleted;
+        uint32_t ordinal_count;
+
+        bool IsDeleted(uint32_t ordinal) const {
+            return deleted != nullptr && (deleted[ordinal / 64] >> (ordinal % 64) & 1) != 0;
+        }
+    };
+
+    // A loaded snapshot with what is derived from it lazily.
+    struct SnapshotState;
+
+    // Document text and words are copied into a monotonic arena, which keeps them at stable
+    // addresses for the string_view keys below; text of removed documents stays there until
+    // the server is destroyed. Nodes of the maps are recycled by a pool.
+    struct IndexMemory {
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::unsynchronized_pool_resource nodes;
     };
 
     const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    // The same words behind a perfect hash, for the lookups of every document and query word.
+    const StopWordSet stop_word_set_;
+    std::unique_ptr<IndexMemory> memory_ = std::make_unique<IndexMemory>();
+    TermDictionary dictionary_;
+    // Indexed by term id. A running compaction shares the lists it rewrites, and a shared list
+    // is copied before it changes (see GetMutablePostings).
+    std::vector<std::shared_ptr<PostingList>> postings_;
+    // Number of documents containing a term, not counting removed ones.
+    std::vector<uint32_t> document_freqs_;
+
+    // Inverse document frequency of a term, valid while epoch equals index_epoch_. Queries refresh
+    // it concurrently, but all of them compute the same value for an epoch.
+    struct CachedInverseDocumentFreq {
+        std::atomic<uint64_t> epoch{ 0 };
+        std::atomic<double> value{ 0.0 };
+    };
+
+    // Changes whenever a document is added or removed, which invalidates every cached IDF and impact.
+    uint64_t index_epoch_ = 1;
+    // Indexed by term id; a deque grows without moving the atomics.
+    mutable std::deque<CachedInverseDocumentFreq> inverse_document_freqs_;
+    // Impacts of posting slots (see PostingListView::Cursor::GetPosition) by term id.
+    std::vector<std::vector<double>> impacts_;
+    uint64_t impacts_epoch_ = 0;
+    std::pmr::map<int, std::pmr::map<std::string_view, double>> document_to_word_freqs_{ &memory_->nodes };
+    // Ordinals of the indexed documents by id, which also gives the ids in order for iteration.
+    std::pmr::map<int, uint32_t> document_ordinals_{ &memory_->nodes };
+    // Columns by ordinal: the ones read while scoring, then the text, which only snapshots,
+    // segment merges and snapshot rebuilds read.
+    std::vector<int> ordinal_to_document_id_;
+    std::vector<int> ratings_;
+    std::vector<DocumentStatus> statuses_;
+    std::vector<double> inv_word_counts_;
+    std::vector<std::string_view> texts_;
+    std::shared_ptr<SnapshotState> snapshot_;
+
+    // Bitmap of the documents with a status, valid while epoch equals index_epoch_.
+    struct StatusFilter {
+        uint64_t epoch = 0;
+        std::shared_ptr<const std::vector<uint64_t>> allowed;
+    };
+
+    // Queries fill the cache concurrently; it lives on the heap so that the server stays movable.
+    struct StatusFilterCache {
+        std::mutex mutex;
+        std::array<StatusFilter, 4> filters;
+    };
+
+    std::unique_ptr<StatusFilterCache> status_filters_ = std::make_unique<StatusFilterCache>();
+
+    // Compaction starts when the removed documents reach an eighth of the remaining ones.
+    static constexpr size_t MIN_COMPACTION_DOCUMENT_COUNT = 1024;
+
+    struct CompactedPostings {
+        uint32_t term;
+        PostingList postings;
+    };
+
+    std::vector<uint64_t> deleted_ordinals_;
+    // (term, ordinal) of postings of removed documents that no compaction has taken yet.
+    std::vector<std::pair<uint32_t, uint32_t>> pending_erasures_;
+    size_t pending_document_count_ = 0;
+    // Compacted copies of posting lists; postings added after the copy are appended when swapping in.
+    std::future<std::vector<CompactedPostings>> compaction_;
+    uint32_t compaction_ordinal_count_ = 0;
+
+    DuplicatePolicy duplicate_policy_ = DuplicatePolicy::ALLOW;
+    // Ids of the documents with each set of words, in order of addition, while duplicates are detected.
+    std::unordered_map<WordSetFingerprint, std::vector<int>, WordSetFingerprint::Hasher> word_set_documents_;
+    std::vector<std::pair<int, int>> duplicate_reports_;
+
+    DocumentColumns GetDocumentColumns() const;
+    std::optional<uint32_t> FindDocumentOrdinal(int document_id) const;
+
+    // Moves the index from a loaded snapshot into memory before it is changed.
+    void MaterializeSnapshot();
+
+    // Words of a contiguous part of a batch, counted per document and grouped by word.
+    // Documents are referred to by their index in the batch.
+    struct PartialIndex {
+        size_t first_document = 0;
+        size_t last_document = 0;
+        std::unordered_map<std::string_view, uint32_t> word_indexes;
+        // Words in order of first occurrence.
+        std::vector<std::string_view> words;
+        // (document, count) for each word and (word, count) for each document, words ordered by text.
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> word_postings;
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> document_words;
+        std::vector<double> inv_word_counts;
+        // Filled when duplicates are detected.
+        std::vector<WordSetFingerprint> fingerprints;
+        // Term id of each word, assigned when the partial index is merged.
+        std::vector<uint32_t> terms;
+        size_t invalid_document = SIZE_MAX;
+        std::exception_ptr error;
+    };
+
+    void CheckNewDocumentId(int document_id) const;
+    // Words may repeat and come in any order.
+    static WordSetFingerprint ComputeFingerprint(std::vector<std::string_view> words);
+    // Throws under DuplicatePolicy::REJECT if a document with the fingerprint is indexed.
+    void CheckDuplicate(const WordSetFingerprint& fingerprint) const;
+    void RegisterFingerprint(int document_id, const WordSetFingerprint& fingerprint);
+
+    void BuildPartialIndex(const std::vector<const NewDocument*>& batch, PartialIndex& partial) const;
+
+    void AddDocumentBatch(const std::execution::parallel_policy&, const std::vector<const NewDocument*>& batch);
+    void AddDocumentBatch(const std::execution::sequenced_policy&, const std::vector<const NewDocument*>& batch);
+
+    template <typename ExecutionPolicy>
+    void AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<const NewDocument*>& batch, size_t chunk_count);
+
+    void RemoveDocumentBatch(const std::execution::parallel_policy&, const std::vector<int>& document_ids);
+    void RemoveDocumentBatch(const std::execution::sequenced_policy&, const std::vector<int>& document_ids);
+
+    // Removes the documents from everything but the posting lists and marks their ordinals deleted.
+    void DetachDocuments(const std::vector<int>& document_ids);
+    template <typename ExecutionPolicy>
+    void StartCompaction(const ExecutionPolicy& policy);
+    // Swaps in the compacted posting lists, unless the task is still running and wait is false.
+    void FinishCompaction(bool wait);
+
+    std::string_view StoreText(std::string_view text);
 
     bool IsStopWord(std::string_view word) const;
 
     static bool IsValidWord(const std::string_view word);
 
     std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view text) const;
+    // Replaces the contents of words, so that a reused vector doesn't allocate.
+    void SplitIntoWordsNoStop(const std::string_view text, std::vector<std::string_view>& words) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
@@ -87,44 +326,234 @@ private:
     QueryWord ParseQueryWord(std::string_view text) const;
 
     struct Query {
+        std::vector<uint32_t> plus_terms;
+        std::vector<uint32_t> minus_terms;
+        // Set when the server is a segment of a larger index: the IDF of every plus term over
+        // the whole index and a bitmap of documents removed from the segment.
+        std::vector<double> inverse_document_freqs;
+        const uint64_t* deleted = nullptr;
+    };
+
+    // Storage for parsing a query, reused by the queries of a thread so that parsing
+    // doesn't allocate once it has grown.
+    struct QueryContext {
+        std::vector<std::string_view> words;
         std::vector<std::string_view> plus_words;
         std::vector<std::string_view> minus_words;
+        std::vector<uint32_t> matched_terms;
+        Query query;
+        // Bitmap of a compiled DocumentFilter.
+        std::vector<uint64_t> allowed_documents;
+    };
+
+    // Holds a context of the current thread while it lives. A thread waiting for the subtasks
+    // of its query may start another query, which then takes the next context of the thread.
+    class QueryContextLease {
+    public:
+        QueryContextLease();
+        QueryContextLease(const QueryContextLease&) = delete;
+        QueryContextLease& operator=(const QueryContextLease&) = delete;
+        ~QueryContextLease();
+
+        QueryContext& operator*() const {
+            return context_;
+        }
+
+        QueryContext* operator->() const {
+            return &context_;
+        }
+
+    private:
+        struct Pool {
+            std::vector<std::unique_ptr<QueryContext>> contexts;
+            size_t leased_count = 0;
+        };
+
+        static Pool& GetPool();
+        static QueryContext& Acquire();
+
+        QueryContext& context_;
     };
 
     Query ParseQuery(const std::string_view text) const;
+    // Parses into context.query.
+    void ParseQuery(const std::string_view text, bool skip_sort, QueryContext& context) const;
+    // Columns with the removed documents of the query, if it has them.
+    DocumentColumns GetDocumentColumns(const Query& query) const;
     Query ParseQuery(const std::string_view text, bool skip_sort) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+    double ComputeWordInverseDocumentFreq(size_t document_freq) const;
+    size_t GetDocumentFreq(uint32_t term, const PostingListView& postings) const;
+    double GetInverseDocumentFreq(uint32_t term, const PostingListView& postings) const;
+    // Impacts of the term's posting slots, or nullptr when they are not up to date.
+    const double* GetImpacts(uint32_t term) const;
+
+    // Returns the id of the word, adding it to the dictionary if it is new.
+    uint32_t InternTerm(const std::string_view word);
+    // Frees the postings of a term left without documents and returns its id to the dictionary.
+    void ReleaseTerm(uint32_t term);
+    std::optional<uint32_t> FindTerm(const std::string_view word) const;
+    std::string_view GetTermWord(uint32_t term) const;
+    PostingListView GetPostings(uint32_t term) const;
+    PostingList& GetMutablePostings(uint32_t term);
+
+    template <typename DocumentPredicate>
+    void AccumulateRelevance(const Query& query, DocumentPredicate document_predicate,
+                             const DocumentColumns& columns, uint32_t first_ordinal, uint32_t last_ordinal,
+                             ScoreAccumulator& accumulator) const;
+
+    void CollectTopDocuments(const ScoreAccumulator& accumulator, const DocumentColumns& columns, TopDocuments& top_documents) const;
+
+    // Predicate of a compiled DocumentFilter, which tests ordinals instead of document attributes.
+    struct AllowedDocuments {
+        const uint64_t* bits;
+    };
+
+    // Returns the bitmap of the filter without the documents removed for the query: a cached one,
+    // which cached_allowed then keeps alive, or one compiled into allowed_documents.
+    const uint64_t* CompileFilter(const DocumentFilter& filter, const Query& query, std::vector<uint64_t>& allowed_documents,
+                                  std::shared_ptr<const std::vector<uint64_t>>& cached_allowed) const;
+    static void ClearDeleted(const DocumentColumns& columns, std::vector<uint64_t>& allowed);
+
+    // Whether a document that isn't removed passes the predicate. Compiled filters have
+    // the removed documents cleared already.
+    template <typename DocumentPredicate>
+    static bool IsAllowed(const DocumentPredicate& document_predicate, const DocumentColumns& columns, uint32_t ordinal) {
+        return !columns.IsDeleted(ordinal)
+               && document_predicate(columns.document_ids[ordinal], columns.statuses[ordinal], columns.ratings[ordinal]);
+    }
+
+    static bool IsAllowed(const AllowedDocuments& allowed, const DocumentColumns&, uint32_t ordinal) {
+        return (allowed.bits[ordinal / 64] >> (ordinal % 64) & 1) != 0;
+    }
+
+    // Scores every document matching the query, but keeps only the max_document_count best ones.
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate, size_t max_document_count) const;
 
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate,
+                                           size_t max_document_count) const;
 
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate,
+                                           size_t max_document_count) const;
 
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindAllDocuments(const scheduling::task_policy& policy, const Query& query, DocumentPredicate document_predicate,
+                                           size_t max_document_count) const;
+
+    // Splits the ordinal space into chunk_count ranges, calls run_chunks(chunk_count, score_chunk)
+    // to score every range, and merges the best documents of the ranges.
+    template <typename DocumentPredicate, typename ChunkRunner>
+    std::vector<Document> FindAllDocumentsInChunks(const Query& query, DocumentPredicate document_predicate, size_t max_document_count,
+                                                   size_t chunk_count, ChunkRunner run_chunks) const;
+
+    struct TermCursor {
+        PostingListView::Cursor postings;
+        double inverse_document_freq;
+        double max_score;
+        const double* impacts;
+        size_t word_index;
+    };
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(const pruning::wand_policy& policy, const Query& query, DocumentPredicate document_predicate,
+                                           size_t max_document_count) const;
+};
+
+// Walks the id map of an in-memory index, or the id index of a loaded snapshot.
+class SearchServer::DocumentIdIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = int;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const int*;
+    using reference = const int&;
+
+    DocumentIdIterator() = default;
+
+    explicit DocumentIdIterator(std::pmr::map<int, uint32_t>::const_iterator position)
+            : position_(position) {
+    }
+
+    explicit DocumentIdIterator(const IndexSnapshot::IdEntry* entry)
+            : entry_(entry) {
+    }
+
+    reference operator*() const {
+        return entry_ != nullptr ? entry_->document_id : position_->first;
+    }
+
+    pointer operator->() const {
+        return &**this;
+    }
+
+    DocumentIdIterator& operator++() {
+        if (entry_ != nullptr) {
+            ++entry_;
+        } else {
+            ++position_;
+        }
+        return *this;
+    }
+
+    DocumentIdIterator operator++(int) {
+        DocumentIdIterator previous = *this;
+        ++*this;
+        return previous;
+    }
+
+    bool operator==(const DocumentIdIterator& other) const {
+        return entry_ == other.entry_ && position_ == other.position_;
+    }
+
+    bool operator!=(const DocumentIdIterator& other) const {
+        return !(*this == other);
+    }
+
+private:
+    std::pmr::map<int, uint32_t>::const_iterator position_;
+    const IndexSnapshot::IdEntry* entry_ = nullptr;
 };
 
 template <typename StringContainer>
 SearchServer::SearchServer(const StringContainer& stop_words)
-        : stop_words_(MakeUniqueNonEmptyStrings(stop_words)) {
+        : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+        , stop_word_set_(stop_words_) {
     using namespace std::string_literals;
     if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid"s);
     }
 }
 
+template <typename ExecutionPolicy, typename DocumentRange>
+void SearchServer::AddDocuments(const ExecutionPolicy& policy, const DocumentRange& documents) {
+    MaterializeSnapshot();
+    std::vector<const NewDocument*> batch;
+    for (const NewDocument& document : documents) {
+        batch.push_back(&document);
+    }
+    AddDocumentBatch(policy, batch);
+}
+
+template <typename ExecutionPolicy, typename DocumentIdRange>
+void SearchServer::RemoveDocuments(const ExecutionPolicy& policy, const DocumentIdRange& document_ids) {
+    RemoveDocumentBatch(policy, std::vector<int>(std::begin(document_ids), std::end(document_ids)));
+}
+
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const{
-    return FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, max_document_count);
 }
 
 template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status,
+                                                     size_t max_document_count) const {
+    DocumentFilter filter;
+    filter.status = status;
+    return FindTopDocuments(policy, raw_query, filter, max_document_count);
 }
 
 template <typename ExecutionPolicy>
@@ -133,100 +562,320 @@ std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& poli
 }
 
 template <typename ExecutionPolicy, typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const SearchServer::Query query = SearchServer::ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
-    sort(
-            policy,
-            matched_documents.begin(),
-            matched_documents.end(),
-            [](const Document& lhs, const Document& rhs) {
-                if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-                    return lhs.rating > rhs.rating;
-                } else {
-                    return lhs.relevance > rhs.relevance;
-                }
-            });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-    return matched_documents;
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    const QueryContextLease context;
+    ParseQuery(raw_query, false, *context);
+    return FindAllDocuments(policy, context->query, document_predicate, max_document_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, const DocumentFilter& filter,
+                                                     size_t max_document_count) const {
+    const QueryContextLease context;
+    ParseQuery(raw_query, false, *context);
+    std::shared_ptr<const std::vector<uint64_t>> cached_allowed;
+    const AllowedDocuments allowed{ CompileFilter(filter, context->query, context->allowed_documents, cached_allowed) };
+    return FindAllDocuments(policy, context->query, allowed, max_document_count);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const{
-    return FindAllDocuments(std::execution::seq, query,document_predicate);
+std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate, size_t max_document_count) const {
+    return FindAllDocuments(std::execution::seq, query, document_predicate, max_document_count);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const auto word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
-            }
+void SearchServer::AccumulateRelevance(const Query& query, DocumentPredicate document_predicate,
+                                       const DocumentColumns& columns, uint32_t first_ordinal, uint32_t last_ordinal,
+                                       ScoreAccumulator& accumulator) const {
+    for (const uint32_t term : query.minus_terms) {
+        const PostingListView postings = GetPostings(term);
+        for (auto cursor = postings.LowerBound(first_ordinal); !cursor.AtEnd() && cursor.GetOrdinal() < last_ordinal; cursor.Next()) {
+            accumulator.Exclude(cursor.GetOrdinal());
         }
     }
 
-    for (const std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    for (size_t word_index = 0; word_index < query.plus_terms.size(); ++word_index) {
+        const uint32_t term = query.plus_terms[word_index];
+        const PostingListView postings = GetPostings(term);
+        if (GetDocumentFreq(term, postings) == 0) {
             continue;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+        const bool is_segment = !query.inverse_document_freqs.empty();
+        const double inverse_document_freq = is_segment ? query.inverse_document_freqs[word_index]
+                                                        : GetInverseDocumentFreq(term, postings);
+        const double* impacts = is_segment ? nullptr : GetImpacts(term);
+        for (auto cursor = postings.LowerBound(first_ordinal); !cursor.AtEnd() && cursor.GetOrdinal() < last_ordinal; cursor.Next()) {
+            const uint32_t document_ordinal = cursor.GetOrdinal();
+            if (accumulator.IsExcluded(document_ordinal)) {
+                continue;
+            }
+            if (IsAllowed(document_predicate, columns, document_ordinal)) {
+                if (impacts != nullptr) {
+                    accumulator.Add(document_ordinal, impacts[cursor.GetPosition()]);
+                } else {
+                    const double term_freq = cursor.GetCount() * columns.inv_word_counts[document_ordinal];
+                    accumulator.Add(document_ordinal, term_freq * inverse_document_freq);
+                }
+            }
         }
     }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    const DocumentColumns columns = GetDocumentColumns(query);
+    const uint32_t document_count = columns.ordinal_count;
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+    accumulator.Reset(document_count);
+    AccumulateRelevance(query, document_predicate, columns, 0, document_count, accumulator);
+    TopDocuments top_documents(max_document_count);
+    CollectTopDocuments(accumulator, columns, top_documents);
+    return top_documents.Extract();
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    return FindAllDocumentsInChunks(query, document_predicate, max_document_count, std::max<size_t>(THREADS_COUNT, 1),
+                                    [](size_t chunk_count, const auto& score_chunk) {
+                                        std::vector<size_t> chunks(chunk_count);
+                                        std::iota(chunks.begin(), chunks.end(), 0);
+                                        std::for_each(std::execution::par, chunks.begin(), chunks.end(), score_chunk);
+                                    });
+}
+
+// Light queries are scored in the task itself, so a batch of them costs no more than with seq.
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const scheduling::task_policy& policy, const Query& query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    size_t posting_count = 0;
+    for (const uint32_t term : query.plus_terms) {
+        posting_count += GetPostings(term).size();
+    }
+    const size_t chunk_count = std::clamp<size_t>(posting_count / std::max<size_t>(policy.min_chunk_postings, 1), 1,
+                                                  policy.scheduler->GetThreadCount());
+    if (chunk_count == 1) {
+        return FindAllDocuments(std::execution::seq, query, document_predicate, max_document_count);
+    }
+    return FindAllDocumentsInChunks(query, document_predicate, max_document_count, chunk_count,
+                                    [&policy](size_t chunk_count, const auto& score_chunk) {
+                                        policy.scheduler->ParallelFor(chunk_count, score_chunk);
+                                    });
+}
+
+// Every task scores its own slice of the ordinal space in its thread's accumulator and selects
+// the best documents of that slice, so the partial heaps are merged without any locking.
+template <typename DocumentPredicate, typename ChunkRunner>
+std::vector<Document> SearchServer::FindAllDocumentsInChunks(const Query& query, DocumentPredicate document_predicate, size_t max_document_count,
+                                                             size_t chunk_count, ChunkRunner run_chunks) const {
+    const DocumentColumns columns = GetDocumentColumns(query);
+    const uint32_t document_count = columns.ordinal_count;
+    std::vector<TopDocuments> partial_top_documents(chunk_count, TopDocuments(max_document_count));
+
+    run_chunks(chunk_count, [this, &query, document_predicate, &columns, document_count, chunk_count, &partial_top_documents](size_t chunk) {
+        const auto first_ordinal = static_cast<uint32_t>(uint64_t{document_count} * chunk / chunk_count);
+        const auto last_ordinal = static_cast<uint32_t>(uint64_t{document_count} * (chunk + 1) / chunk_count);
+        ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+        accumulator.Reset(document_count);
+        AccumulateRelevance(query, document_predicate, columns, first_ordinal, last_ordinal, accumulator);
+        CollectTopDocuments(accumulator, columns, partial_top_documents[chunk]);
+    });
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    TopDocuments top_documents(max_document_count);
+    for (const auto& partial : partial_top_documents) {
+        top_documents.Merge(partial);
     }
-    return matched_documents;
+    return top_documents.Extract();
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(THREADS_COUNT);
-
-    std::for_each(
-            std::execution::par,
-            query.plus_words.begin(),
-            query.plus_words.end(),
-            [this, document_predicate, &document_to_relevance](std::string_view word){
-                if (word_to_document_freqs_.count(word) == 0) {
-                    return;
+std::vector<Document> SearchServer::FindAllDocuments(const pruning::wand_policy& policy, const Query& query, DocumentPredicate document_predicate,
+                                                     size_t max_document_count) const {
+    if (max_document_count == 0) {
+        return {};
+    }
+    const DocumentColumns columns = GetDocumentColumns(query);
+    ScoreAccumulator& accumulator = ScoreAccumulator::ForCurrentThread();
+    accumulator.Reset(columns.ordinal_count);
+    for (const uint32_t term : query.minus_terms) {
+        for (auto cursor = GetPostings(term).GetCursor(); !cursor.AtEnd(); cursor.Next()) {
+            accumulator.Exclude(cursor.GetOrdinal());
+        }
+    }
+
+    std::vector<TermCursor> term_cursors;
+    term_cursors.reserve(query.plus_terms.size());
+    uint64_t total_postings = 0;
+    for (size_t word_index = 0; word_index < query.plus_terms.size(); ++word_index) {
+        const uint32_t term = query.plus_terms[word_index];
+        const PostingListView postings = GetPostings(term);
+        if (GetDocumentFreq(term, postings) == 0) {
+            continue;
+        }
+        const bool is_segment = !query.inverse_document_freqs.empty();
+        const double inverse_document_freq = is_segment ? query.inverse_document_freqs[word_index]
+                                                        : GetInverseDocumentFreq(term, postings);
+        term_cursors.push_back({ postings.GetCursor(), inverse_document_freq, postings.GetMaxTermFreq() * inverse_document_freq,
+                                 is_segment ? nullptr : GetImpacts(term), word_index });
+        total_postings += postings.size();
+    }
+
+    // Cursors are ordered by their bounds (MaxScore). Once the top is full, the longest prefix
+    // of them whose bounds sum to no more than the worst kept relevance can't make a document
+    // outrank it on their own: these non-essential cursors are only moved to documents found
+    // by the essential ones. Cursors are handled through pointers since each one carries
+    // a decoded block.
+    std::vector<TermCursor*> cursors;
+    for (auto& term_cursor : term_cursors) {
+        cursors.push_back(&term_cursor);
+    }
+    std::sort(cursors.begin(), cursors.end(), [](const TermCursor* lhs, const TermCursor* rhs) {
+        return lhs->max_score < rhs->max_score;
+    });
+    std::vector<double> bound_sums(cursors.size());
+    double bound_sum = 0.0;
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        bound_sum += cursors[i]->max_score;
+        bound_sums[i] = bound_sum;
+    }
+    // Essential cursors are in query word order, so their scores are summed in the same order
+    // as by the exhaustive strategies.
+    size_t essential_begin = 0;
+    std::vector<TermCursor*> essential_cursors;
+    const auto collect_essential_cursors = [&cursors, &essential_begin, &essential_cursors]() {
+        essential_cursors.assign(cursors.begin() + essential_begin, cursors.end());
+        std::sort(essential_cursors.begin(), essential_cursors.end(), [](const TermCursor* lhs, const TermCursor* rhs) {
+            return lhs->word_index < rhs->word_index;
+        });
+    };
+    collect_essential_cursors();
+
+    const auto score = [&columns](const TermCursor& term_cursor, const PostingListView::Cursor& cursor, uint32_t document_ordinal) {
+        if (term_cursor.impacts != nullptr) {
+            return term_cursor.impacts[cursor.GetPosition()];
+        }
+        return cursor.GetCount() * columns.inv_word_counts[document_ordinal] * term_cursor.inverse_document_freq;
+    };
+
+    TopDocuments top_documents(max_document_count);
+    // A document with a score below the worst kept one by EPSILON or more can't outrank it.
+    double threshold = 0.0;
+    uint64_t scored_postings = 0;
+    // The essential cursors are scored a window of ordinals at a time into the accumulator,
+    // which costs as little per posting as exhaustive scoring, and then the documents of
+    // the window are checked in ordinal order, the order non-essential cursors move in.
+    // The score of every word is kept for the window, so a kept document gets its relevance
+    // summed in word order, the same as by the exhaustive strategies.
+    std::array<uint64_t, WAND_WINDOW_SIZE / 64> window_documents;
+    const size_t word_count = query.plus_terms.size();
+    std::vector<uint64_t> window_word_documents(word_count * WAND_WINDOW_SIZE / 64);
+    std::vector<double> window_word_scores(word_count * WAND_WINDOW_SIZE);
+    std::vector<double> probed_word_scores(word_count, 0.0);
+    while (true) {
+        uint32_t window_begin = UINT32_MAX;
+        for (const TermCursor* cursor : essential_cursors) {
+            if (!cursor->postings.AtEnd()) {
+                window_begin = std::min(window_begin, cursor->postings.GetOrdinal());
+            }
+        }
+        if (window_begin == UINT32_MAX) {
+            break;
+        }
+        const auto window_end = static_cast<uint32_t>(std::min<uint64_t>(uint64_t{window_begin} + WAND_WINDOW_SIZE, UINT32_MAX));
+        window_documents.fill(0);
+        std::fill(window_word_documents.begin(), window_word_documents.end(), 0);
+        for (TermCursor* cursor : essential_cursors) {
+            PostingListView::Cursor& postings = cursor->postings;
+            for (; !postings.AtEnd() && postings.GetOrdinal() < window_end; postings.Next()) {
+                const uint32_t document_ordinal = postings.GetOrdinal();
+                if (!accumulator.IsExcluded(document_ordinal)) {
+                    const double word_score = score(*cursor, postings, document_ordinal);
+                    accumulator.Add(document_ordinal, word_score);
+                    const uint32_t offset = document_ordinal - window_begin;
+                    window_documents[offset / 64] |= uint64_t{1} << (offset % 64);
+                    const size_t slot = cursor->word_index * WAND_WINDOW_SIZE + offset;
+                    window_word_documents[slot / 64] |= uint64_t{1} << (slot % 64);
+                    window_word_scores[slot] = word_score;
+                    ++scored_postings;
+                }
+            }
+        }
+
+        const size_t old_essential_begin = essential_begin;
+        for (size_t word = 0; word < window_documents.size(); ++word) {
+            for (uint64_t bits = window_documents[word]; bits != 0; bits &= bits - 1) {
+                const uint32_t document_ordinal = window_begin + static_cast<uint32_t>(word * 64 + __builtin_ctzll(bits));
+                if (!IsAllowed(document_predicate, columns, document_ordinal)) {
+                    continue;
+                }
+                double relevance = accumulator.GetScore(document_ordinal);
+                // The non-essential cursors are moved to the document from the one with the highest bound,
+                // as long as the document can still outrank the worst kept one. The bound of the block
+                // that may hold the document, found without decoding it, is tighter than the cursor's own.
+                // Cursors that became non-essential in this window have already passed it.
+                bool can_outrank = true;
+                for (size_t i = 0; i < old_essential_begin; ++i) {
+                    probed_word_scores[cursors[i]->word_index] = 0.0;
                 }
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                    const auto& document_data = documents_.at(document_id);
-                    if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                        document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+                for (size_t i = old_essential_begin; i-- > 0;) {
+                    const double rest_bound = i > 0 ? bound_sums[i - 1] : 0.0;
+                    if (relevance + rest_bound + cursors[i]->max_score <= threshold) {
+                        can_outrank = false;
+                        break;
+                    }
+                    TermCursor& cursor = *cursors[i];
+                    PostingListView::Cursor& postings = cursor.postings;
+                    if (postings.AtEnd() || postings.GetOrdinal() > document_ordinal) {
+                        continue;
+                    }
+                    const double block_bound = postings.GetBlockBound(document_ordinal).max_term_freq * cursor.inverse_document_freq;
+                    if (relevance + rest_bound + block_bound <= threshold) {
+                        can_outrank = false;
+                        break;
+                    }
+                    postings.SkipTo(document_ordinal);
+                    if (!postings.AtEnd() && postings.GetOrdinal() == document_ordinal) {
+                        const double word_score = score(cursor, postings, document_ordinal);
+                        relevance += word_score;
+                        probed_word_scores[cursor.word_index] = word_score;
+                        ++scored_postings;
                     }
                 }
-            });
-            
-    std::for_each(
-            std::execution::par,
-            query.minus_words.begin(),
-            query.minus_words.end(),
-            [this, &document_to_relevance](std::string_view word){
-                if (word_to_document_freqs_.count(word) == 0) {
-                    return;
+                if (!can_outrank) {
+                    continue;
                 }
-                for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                    document_to_relevance.erase(document_id);
+                if (old_essential_begin > 0) {
+                    // Scores of non-essential words were added after the others.
+                    relevance = 0.0;
+                    const uint32_t offset = document_ordinal - window_begin;
+                    for (const TermCursor& term_cursor : term_cursors) {
+                        const size_t slot = term_cursor.word_index * WAND_WINDOW_SIZE + offset;
+                        relevance += (window_word_documents[slot / 64] >> (slot % 64) & 1) != 0
+                                     ? window_word_scores[slot]
+                                     : probed_word_scores[term_cursor.word_index];
+                    }
                 }
-            });
+                top_documents.Push({ columns.document_ids[document_ordinal], relevance, columns.ratings[document_ordinal] });
+                if (top_documents.IsFull()) {
+                    threshold = top_documents.GetWorst().relevance - EPSILON;
+                    while (essential_begin < cursors.size() && bound_sums[essential_begin] <= threshold) {
+                        ++essential_begin;
+                    }
+                }
+            }
+        }
+        if (essential_begin != old_essential_begin) {
+            collect_essential_cursors();
+        }
+    }
+
+    std::vector<Document> documents = top_documents.Extract();
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    if (policy.stats != nullptr) {
+        policy.stats->postings_scored += scored_postings;
+        policy.stats->postings_skipped += total_postings - scored_postings;
     }
-    return matched_documents;
+    return documents;
 }
@@ -0,0 +1,323 @@
+#include "segmented_search_server.h"
+
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+size_t GetThreadIndex() {
+    static atomic<size_t> next_index = 0;
+    thread_local const size_t index = next_index++;
+    return index;
+}
+
+bool IsDeleted(const vector<uint64_t>& ordinals, uint32_t ordinal) {
+    return (ordinals[ordinal / 64] >> (ordinal % 64) & 1) != 0;
+}
+
+}  // namespace
+
+SegmentedSearchServer::SegmentedSearchServer(const string& stop_words_text)
+        : SegmentedSearchServer(SplitIntoWords(stop_words_text))
+{
+}
+
+SegmentedSearchServer::SegmentedSearchServer(const string_view stop_words_text)
+        : SegmentedSearchServer(SplitIntoWordsView(stop_words_text))
+{
+}
+
+int SegmentedSearchServer::Segment::GetDocumentCount() const {
+    return index->GetDocumentCount() - (deletes ? deletes->count : 0);
+}
+
+bool SegmentedSearchServer::Segment::Contains(int document_id) const {
+    const auto ordinal = index->FindDocumentOrdinal(document_id);
+    return ordinal && !(deletes && IsDeleted(deletes->ordinals, *ordinal));
+}
+
+SegmentedSearchServer::ReadSection::ReadSection(const SegmentedSearchServer& server)
+        : readers_(server.reader_counters_[GetThreadIndex() % READER_COUNTER_COUNT].readers[server.reader_epoch_.load() & 1]) {
+    readers_.fetch_add(1);
+    version_ = server.published_version_.load();
+}
+
+SegmentedSearchServer::ReadSection::~ReadSection() {
+    readers_.fetch_sub(1);
+}
+
+void SegmentedSearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
+    lock_guard lock(write_mutex_);
+    if (document_id < 0) {
+        throw invalid_argument("id document invalid"s);
+    }
+    if (pending_document_ids_.count(document_id) > 0 || (IsPublished(document_id) && pending_removals_.count(document_id) == 0)) {
+        throw invalid_argument("document with id already added"s);
+    }
+    for (const string_view word : SplitIntoWordsView(document)) {
+        if (!SearchServer::IsValidWord(word)) {
+            throw invalid_argument("Word is invalid"s);
+        }
+    }
+    pending_documents_.push_back({ document_id, string(document), status, ratings });
+    pending_document_ids_.insert(document_id);
+    if (pending_documents_.size() >= BATCH_DOCUMENT_COUNT) {
+        FlushBatch();
+    }
+}
+
+void SegmentedSearchServer::RemoveDocument(int document_id) {
+    lock_guard lock(write_mutex_);
+    if (pending_document_ids_.erase(document_id) > 0) {
+        pending_documents_.erase(find_if(pending_documents_.begin(), pending_documents_.end(), [document_id](const PendingDocument& document) {
+            return document.id == document_id;
+        }));
+        return;
+    }
+    if (IsPublished(document_id) && pending_removals_.insert(document_id).second
+            && pending_removals_.size() >= BATCH_DOCUMENT_COUNT) {
+        FlushBatch();
+    }
+}
+
+void SegmentedSearchServer::Flush() {
+    lock_guard lock(write_mutex_);
+    FlushBatch();
+}
+
+vector<Document> SegmentedSearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status, size_t max_document_count) const {
+    return FindTopDocuments(execution::seq, raw_query, status, max_document_count);
+}
+
+vector<Document> SegmentedSearchServer::FindTopDocuments(const string_view raw_query) const {
+    return FindTopDocuments(execution::seq, raw_query, DocumentStatus::ACTUAL);
+}
+
+vector<Document> SegmentedSearchServer::FindTopDocuments(const string_view raw_query, const DocumentFilter& filter, size_t max_document_count) const {
+    return FindTopDocuments(execution::seq, raw_query, filter, max_document_count);
+}
+
+tuple<vector<string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(const string_view raw_query, int document_id) const {
+    return MatchPublishedDocument(execution::seq, raw_query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(const execution::parallel_policy& policy, const string_view raw_query,
+                                                                                int document_id) const {
+    return MatchPublishedDocument(policy, raw_query, document_id);
+}
+
+tuple<vector<string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(const execution::sequenced_policy& policy, const string_view raw_query,
+                                                                                int document_id) const {
+    return MatchPublishedDocument(policy, raw_query, document_id);
+}
+
+// The query is parsed by the segment that holds the document, and its words are matched while
+// they still point into raw_query.
+template <typename ExecutionPolicy>
+tuple<vector<string_view>, DocumentStatus> SegmentedSearchServer::MatchPublishedDocument(const ExecutionPolicy& policy, const string_view raw_query,
+                                                                                         int document_id) const {
+    const ReadSection read_section(*this);
+    for (const Segment& segment : read_section.GetSegments()) {
+        if (!segment.Contains(document_id)) {
+            continue;
+        }
+        const SearchServer& index = *segment.index;
+        const uint32_t ordinal = *index.FindDocumentOrdinal(document_id);
+        const DocumentStatus status = index.GetDocumentColumns().statuses[ordinal];
+        const SearchServer::QueryContextLease context;
+        index.ParseQuery(raw_query, false, *context);
+        const auto word_checker = [&index, ordinal](const string_view word) {
+            const auto term = index.FindTerm(word);
+            return term && index.GetPostings(*term).Contains(ordinal);
+        };
+        if (any_of(policy, context->minus_words.begin(), context->minus_words.end(), word_checker)) {
+            return { vector<string_view>{}, status };
+        }
+        vector<string_view> matched_words(context->plus_words.size());
+        matched_words.erase(copy_if(policy, context->plus_words.begin(), context->plus_words.end(), matched_words.begin(), word_checker),
+                            matched_words.end());
+        return { move(matched_words), status };
+    }
+    throw out_of_range("incorrect document_id");
+}
+
+int SegmentedSearchServer::GetDocumentCount() const {
+    const ReadSection read_section(*this);
+    int document_count = 0;
+    for (const Segment& segment : read_section.GetSegments()) {
+        document_count += segment.GetDocumentCount();
+    }
+    return document_count;
+}
+
+size_t SegmentedSearchServer::GetSegmentCount() const {
+    const ReadSection read_section(*this);
+    return read_section.GetSegments().size();
+}
+
+bool SegmentedSearchServer::IsPublished(int document_id) const {
+    return any_of(version_->segments.begin(), version_->segments.end(), [document_id](const Segment& segment) {
+        return segment.Contains(document_id);
+    });
+}
+
+void SegmentedSearchServer::FlushBatch() {
+    if (pending_documents_.empty() && pending_removals_.empty()) {
+        return;
+    }
+    SegmentList segments = version_->segments;
+    RemovePublishedDocuments(segments);
+    if (!pending_documents_.empty()) {
+        vector<NewDocument> documents;
+        documents.reserve(pending_documents_.size());
+        for (const PendingDocument& document : pending_documents_) {
+            documents.push_back({ document.id, document.text, document.status, document.ratings });
+        }
+        segments.push_back(BuildSegment(documents));
+    }
+    MergeSegments(segments);
+    Publish(make_unique<const IndexVersion>(IndexVersion{ move(segments) }));
+    pending_documents_.clear();
+    pending_document_ids_.clear();
+    pending_removals_.clear();
+}
+
+// Deletion bitmaps and document frequencies of a segment are copied once per batch.
+void SegmentedSearchServer::RemovePublishedDocuments(SegmentList& segments) const {
+    for (Segment& segment : segments) {
+        const SearchServer& index = *segment.index;
+        shared_ptr<SegmentDeletes> deletes;
+        for (const int document_id : pending_removals_) {
+            if (!segment.Contains(document_id)) {
+                continue;
+            }
+            if (!deletes) {
+                deletes = segment.deletes ? make_shared<SegmentDeletes>(*segment.deletes)
+                                          : make_shared<SegmentDeletes>(SegmentDeletes{ index.deleted_ordinals_, index.document_freqs_, 0 });
+            }
+            const uint32_t ordinal = *index.FindDocumentOrdinal(document_id);
+            deletes->ordinals[ordinal / 64] |= uint64_t{1} << (ordinal % 64);
+            ++deletes->count;
+            for (const auto& [word, term_freq] : index.GetWordFrequencies(document_id)) {
+                --deletes->document_freqs[*index.FindTerm(word)];
+            }
+        }
+        if (deletes) {
+            segment.deletes = move(deletes);
+        }
+    }
+}
+
+// A segment that has lost half of its documents is rewritten on its own.
+void SegmentedSearchServer::MergeSegments(SegmentList& segments) const {
+    while (true) {
+        auto first = find_if(segments.cbegin(), segments.cend(), [](const Segment& segment) {
+            return segment.deletes && segment.deletes->count * 2 >= segment.index->GetDocumentCount();
+        });
+        auto last = first == segments.cend() ? first : first + 1;
+        if (first == segments.cend() && segments.size() >= MERGE_FACTOR) {
+            first = segments.cend() - MERGE_FACTOR;
+            last = segments.cend();
+            const size_t tier = GetSizeTier(first->GetDocumentCount());
+            if (!all_of(first, last, [tier](const Segment& segment) {
+                    return GetSizeTier(segment.GetDocumentCount()) == tier;
+                })) {
+                return;
+            }
+        }
+        if (first == last) {
+            return;
+        }
+
+        Segment merged = BuildSegment(first, last);
+        const auto position = segments.erase(first, last);
+        if (merged.index->GetDocumentCount() > 0) {
+            segments.insert(position, move(merged));
+        }
+    }
+}
+
+// Publishing waits for the readers of the replaced version, so merged segments are freed right away.
+void SegmentedSearchServer::Publish(unique_ptr<const IndexVersion> version) {
+    published_version_.store(version.get());
+    for (int flip = 0; flip < 2; ++flip) {
+        const uint64_t parity = reader_epoch_.fetch_add(1) & 1;
+        for (const ReaderCounter& counter : reader_counters_) {
+            while (counter.readers[parity].load() != 0) {
+                this_thread::yield();
+            }
+        }
+    }
+    version_ = move(version);
+}
+
+SegmentedSearchServer::Segment SegmentedSearchServer::BuildSegment(SegmentList::const_iterator first, SegmentList::const_iterator last) const {
+    vector<NewDocument> documents;
+    for (auto segment = first; segment != last; ++segment) {
+        const SearchServer& index = *segment->index;
+        for (const auto& [document_id, ordinal] : index.document_ordinals_) {
+            if (segment->deletes && IsDeleted(segment->deletes->ordinals, ordinal)) {
+                continue;
+            }
+            documents.push_back({ document_id, index.texts_[ordinal], index.statuses_[ordinal], { index.ratings_[ordinal] } });
+        }
+    }
+    return BuildSegment(documents);
+}
+
+SegmentedSearchServer::Segment SegmentedSearchServer::BuildSegment(const vector<NewDocument>& documents) const {
+    auto index = make_shared<SearchServer>(stop_words_);
+    index->AddDocuments(execution::par, documents);
+    return { move(index), nullptr };
+}
+
+size_t SegmentedSearchServer::GetSizeTier(int document_count) {
+    size_t tier = 0;
+    for (size_t size = BATCH_DOCUMENT_COUNT * MERGE_FACTOR; size <= static_cast<size_t>(document_count); size *= MERGE_FACTOR) {
+        ++tier;
+    }
+    return tier;
+}
+
+// Plus words without documents in any segment are dropped, as SearchServer skips them.
+vector<SearchServer::Query> SegmentedSearchServer::ParseQueries(const SegmentList& segments, const string_view raw_query) const {
+    if (segments.empty()) {
+        empty_index_.ParseQuery(raw_query);
+        return {};
+    }
+    vector<SearchServer::Query> queries;
+    queries.reserve(segments.size());
+    unordered_map<string_view, size_t> document_freqs;
+    int document_count = 0;
+    for (const Segment& segment : segments) {
+        const SearchServer& index = *segment.index;
+        SearchServer::Query& query = queries.emplace_back(index.ParseQuery(raw_query));
+        for (const uint32_t term : query.plus_terms) {
+            document_freqs[index.GetTermWord(term)] += segment.deletes ? segment.deletes->document_freqs[term]
+                                                                       : index.GetDocumentFreq(term, index.GetPostings(term));
+        }
+        query.deleted = segment.deletes ? segment.deletes->ordinals.data() : nullptr;
+        document_count += segment.GetDocumentCount();
+    }
+
+    for (size_t i = 0; i < queries.size(); ++i) {
+        SearchServer::Query& query = queries[i];
+        vector<uint32_t> plus_terms;
+        for (const uint32_t term : query.plus_terms) {
+            const size_t document_freq = document_freqs.at(segments[i].index->GetTermWord(term));
+            if (document_freq == 0) {
+                continue;
+            }
+            plus_terms.push_back(term);
+            query.inverse_document_freqs.push_back(log(document_count * 1.0 / document_freq));
+        }
+        query.plus_terms = move(plus_terms);
+    }
+    return queries;
+}
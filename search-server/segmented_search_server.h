@@ -0,0 +1,235 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <execution>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include "document.h"
+#include "document_filter.h"
+#include "search_server.h"
+#include "top_documents.h"
+
+// Search index that takes documents from a writer thread while any number of threads query it.
+// The index is an immutable version made of SearchServer segments. The writer collects added and
+// removed documents into a batch and publishes a new version with a segment built from the batch,
+// so queries never see a partial change and read the published version without taking any lock.
+// A replaced version is freed once every query that could have entered it has left (see ReadSection).
+// Documents removed from a segment are marked in a copy of its deletion bitmap, and a merge policy
+// keeps the number of segments logarithmic. IDF is computed over all segments, so results are the
+// same as with a single SearchServer holding the published documents.
+class SegmentedSearchServer {
+public:
+    // A batch is published when it has this many added or removed documents.
+    static constexpr size_t BATCH_DOCUMENT_COUNT = 1024;
+    // The newest MERGE_FACTOR segments are merged when they are of the same size tier,
+    // so there are at most MERGE_FACTOR - 1 segments of each tier.
+    static constexpr size_t MERGE_FACTOR = 4;
+
+    template <typename StringContainer>
+    explicit SegmentedSearchServer(const StringContainer& stop_words);
+
+    explicit SegmentedSearchServer(const std::string& stop_words_text);
+    explicit SegmentedSearchServer(const std::string_view stop_words_text);
+
+    SegmentedSearchServer(const SegmentedSearchServer&) = delete;
+    SegmentedSearchServer& operator=(const SegmentedSearchServer&) = delete;
+
+    // Changes become visible to queries when their batch is published. Invalid documents
+    // are rejected right away with the same exceptions as SearchServer::AddDocument.
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+    // Publishes the current batch.
+    void Flush();
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentPredicate document_predicate,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query) const;
+
+    // Filters are compiled into a bitmap for every segment, as by SearchServer.
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, const DocumentFilter& filter,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, const DocumentFilter& filter,
+                                           size_t max_document_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Matched words point into raw_query, since the segment that holds the document may be freed after the call.
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, const std::string_view raw_query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy&, const std::string_view raw_query, int document_id) const;
+
+    // Number of published documents.
+    int GetDocumentCount() const;
+    size_t GetSegmentCount() const;
+
+private:
+    // Documents removed from a segment, and what remains of its document frequencies.
+    struct SegmentDeletes {
+        std::vector<uint64_t> ordinals;
+        std::vector<uint32_t> document_freqs;
+        int count = 0;
+    };
+
+    struct Segment {
+        std::shared_ptr<const SearchServer> index;
+        std::shared_ptr<const SegmentDeletes> deletes;
+
+        int GetDocumentCount() const;
+        bool Contains(int document_id) const;
+    };
+
+    using SegmentList = std::vector<Segment>;
+
+    struct IndexVersion {
+        SegmentList segments;
+    };
+
+    // Readers count themselves in one of two counters chosen by the parity of the reader epoch,
+    // spread over cache lines by thread. A writer that has published a version flips the epoch twice
+    // and waits for the counters of the previous parity to drain each time, as sleepable RCU does:
+    // after that no reader can still hold the replaced version.
+    struct alignas(64) ReaderCounter {
+        std::atomic<uint64_t> readers[2]{};
+    };
+
+    static constexpr size_t READER_COUNTER_COUNT = 64;
+
+    // Keeps the version published when it is entered alive until it is left; takes no lock.
+    class ReadSection {
+    public:
+        explicit ReadSection(const SegmentedSearchServer& server);
+        ReadSection(const ReadSection&) = delete;
+        ReadSection& operator=(const ReadSection&) = delete;
+        ~ReadSection();
+
+        const SegmentList& GetSegments() const {
+            return version_->segments;
+        }
+
+    private:
+        std::atomic<uint64_t>& readers_;
+        const IndexVersion* version_;
+    };
+
+    struct PendingDocument {
+        int id;
+        std::string text;
+        DocumentStatus status;
+        std::vector<int> ratings;
+    };
+
+    const std::set<std::string, std::less<>> stop_words_;
+    // Parses queries when there are no segments.
+    const SearchServer empty_index_;
+
+    mutable std::array<ReaderCounter, READER_COUNTER_COUNT> reader_counters_;
+    std::atomic<uint64_t> reader_epoch_{ 0 };
+    std::atomic<const IndexVersion*> published_version_;
+
+    // Writer state: serialized by write_mutex_, which queries never take.
+    std::mutex write_mutex_;
+    std::unique_ptr<const IndexVersion> version_;
+    std::vector<PendingDocument> pending_documents_;
+    std::unordered_set<int> pending_document_ids_;
+    // Published documents to remove.
+    std::unordered_set<int> pending_removals_;
+
+    bool IsPublished(int document_id) const;
+    void FlushBatch();
+    void RemovePublishedDocuments(SegmentList& segments) const;
+    void MergeSegments(SegmentList& segments) const;
+    void Publish(std::unique_ptr<const IndexVersion> version);
+
+    // Indexes the remaining documents of segments into a new one.
+    Segment BuildSegment(SegmentList::const_iterator first, SegmentList::const_iterator last) const;
+    Segment BuildSegment(const std::vector<NewDocument>& documents) const;
+    static size_t GetSizeTier(int document_count);
+
+    // Parses the query for every segment and sets the IDF of its words over all of them.
+    std::vector<SearchServer::Query> ParseQueries(const SegmentList& segments, const std::string_view raw_query) const;
+
+    template <typename ExecutionPolicy>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchPublishedDocument(const ExecutionPolicy& policy, const std::string_view raw_query,
+                                                                                     int document_id) const;
+};
+
+template <typename StringContainer>
+SegmentedSearchServer::SegmentedSearchServer(const StringContainer& stop_words)
+        : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+        , empty_index_(stop_words_)
+        , version_(std::make_unique<const IndexVersion>()) {
+    published_version_.store(version_.get());
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate,
+                                                              size_t max_document_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, max_document_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query, DocumentStatus status,
+                                                              size_t max_document_count) const {
+    return FindTopDocuments(policy, raw_query, [status](int, DocumentStatus document_status, int) {
+        return document_status == status;
+    }, max_document_count);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+// Every segment selects its own best documents, and those are merged.
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query,
+                                                              DocumentPredicate document_predicate, size_t max_document_count) const {
+    const ReadSection read_section(*this);
+    const SegmentList& segments = read_section.GetSegments();
+    const std::vector<SearchServer::Query> queries = ParseQueries(segments, raw_query);
+    TopDocuments top_documents(max_document_count);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (const Document& document : segments[i].index->FindAllDocuments(policy, queries[i], document_predicate, max_document_count)) {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.Extract();
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const ExecutionPolicy& policy, const std::string_view raw_query,
+                                                              const DocumentFilter& filter, size_t max_document_count) const {
+    const ReadSection read_section(*this);
+    const SegmentList& segments = read_section.GetSegments();
+    const std::vector<SearchServer::Query> queries = ParseQueries(segments, raw_query);
+    const SearchServer::QueryContextLease context;
+    TopDocuments top_documents(max_document_count);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::shared_ptr<const std::vector<uint64_t>> cached_allowed;
+        const SearchServer::AllowedDocuments allowed{
+            segments[i].index->CompileFilter(filter, queries[i], context->allowed_documents, cached_allowed) };
+        for (const Document& document : segments[i].index->FindAllDocuments(policy, queries[i], allowed, max_document_count)) {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.Extract();
+}
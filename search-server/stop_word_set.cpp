@@ -0,0 +1,88 @@
+#include "stop_word_set.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+namespace {
+
+// A bucket that no seed below this places is retried with another hash seed.
+constexpr uint32_t MAX_BUCKET_SEED = 1u << 16;
+
+}  // namespace
+
+StopWordSet::StopWordSet(const set<string, less<>>& words) {
+    vector<string_view> stored_words;
+    for (const string& word : words) {
+        if (!word.empty()) {
+            stored_words.push_back(word);
+        }
+    }
+    if (stored_words.empty()) {
+        return;
+    }
+    for (hash_seed_ = 0; !TryBuild(stored_words); ++hash_seed_) {
+    }
+    for (const string_view word : stored_words) {
+        characters_.append(word);
+    }
+    size_ = stored_words.size();
+}
+
+// Two words per bucket and a half-empty table keep the seed search short.
+bool StopWordSet::TryBuild(const vector<string_view>& words) {
+    size_t slot_count = 1;
+    while (slot_count < 2 * words.size()) {
+        slot_count *= 2;
+    }
+    slots_.assign(slot_count, Slot());
+    seeds_.assign(max<size_t>(words.size() / 2, 1), 0);
+
+    vector<uint64_t> hashes(words.size());
+    vector<uint32_t> offsets(words.size());
+    vector<vector<uint32_t>> buckets(seeds_.size());
+    uint32_t offset = 0;
+    for (size_t index = 0; index < words.size(); ++index) {
+        hashes[index] = Hash(words[index], hash_seed_);
+        offsets[index] = offset;
+        offset += static_cast<uint32_t>(words[index].size());
+        buckets[GetBucket(hashes[index])].push_back(static_cast<uint32_t>(index));
+    }
+
+    vector<size_t> bucket_order(buckets.size());
+    iota(bucket_order.begin(), bucket_order.end(), 0);
+    stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](size_t lhs, size_t rhs) {
+        return buckets[lhs].size() > buckets[rhs].size();
+    });
+
+    vector<size_t> placed;
+    for (const size_t bucket : bucket_order) {
+        if (buckets[bucket].empty()) {
+            break;
+        }
+        uint32_t seed = 0;
+        for (; seed < MAX_BUCKET_SEED; ++seed) {
+            placed.clear();
+            for (const uint32_t index : buckets[bucket]) {
+                const size_t slot = GetSlot(hashes[index], seed);
+                if (slots_[slot].length != 0) {
+                    break;
+                }
+                slots_[slot] = {hashes[index], offsets[index], static_cast<uint32_t>(words[index].size())};
+                placed.push_back(slot);
+            }
+            if (placed.size() == buckets[bucket].size()) {
+                break;
+            }
+            for (const size_t slot : placed) {
+                slots_[slot] = Slot();
+            }
+        }
+        if (seed == MAX_BUCKET_SEED) {
+            return false;
+        }
+        seeds_[bucket] = seed;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Immutable set of words with a perfect hash: every word has a slot of its own, so a lookup
+// hashes the word once, reads one slot and compares characters only on a full hash match.
+// Built by hash and displace: words are spread over buckets, and every bucket, largest first,
+// gets the first seed that places all of its words into free slots.
+class StopWordSet {
+public:
+    StopWordSet() = default;
+    explicit StopWordSet(const std::set<std::string, std::less<>>& words);
+
+    // Empty words are never stored, which leaves length 0 to mark free slots.
+    bool Contains(std::string_view word) const {
+        if (slots_.empty() || word.empty()) {
+            return false;
+        }
+        const uint64_t hash = Hash(word, hash_seed_);
+        const Slot& slot = slots_[GetSlot(hash, seeds_[GetBucket(hash)])];
+        return slot.hash == hash && slot.length == word.size()
+               && std::string_view(characters_.data() + slot.offset, slot.length) == word;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    // Reads the word eight bytes at a time; stop words are short, so it is a couple of multiplications.
+    static uint64_t Hash(std::string_view word, uint64_t seed) {
+        uint64_t hash = seed ^ (word.size() * 0x9E3779B97F4A7C15ull);
+        size_t position = 0;
+        for (; position + 8 <= word.size(); position += 8) {
+            uint64_t bytes;
+            std::memcpy(&bytes, word.data() + position, 8);
+            hash = (hash ^ bytes) * 0xFF51AFD7ED558CCDull;
+            hash ^= hash >> 32;
+        }
+        uint64_t tail = 0;
+        if (position < word.size()) {
+            std::memcpy(&tail, word.data() + position, word.size() - position);
+        }
+        hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+        return hash ^ (hash >> 29);
+    }
+
+    size_t GetBucket(uint64_t hash) const {
+        return (hash >> 32) % seeds_.size();
+    }
+
+    size_t GetSlot(uint64_t hash, uint32_t seed) const {
+        uint64_t mixed = (hash ^ seed) * 0x9E3779B97F4A7C15ull;
+        return (mixed ^ (mixed >> 29)) & (slots_.size() - 1);
+    }
+
+    bool TryBuild(const std::vector<std::string_view>& words);
+
+    // Words are copied here, so the set may outlive the strings it was built from.
+    std::string characters_;
+    uint64_t hash_seed_ = 0;
+    std::vector<uint32_t> seeds_;
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+};
@@ -1,5 +1,11 @@
 #include "string_processing.h"
 
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 vector<string> SplitIntoWords(const string& text) {
@@ -24,15 +30,91 @@ vector<string> SplitIntoWords(const string& text) {
 
 vector<string_view> SplitIntoWordsView(string_view text) {
     vector<string_view> words;
-    while (true) {
-        size_t space = text.find(' ');
-        words.push_back(text.substr(0, space));
-        if (space == text.npos) {
-            break;
+    SplitIntoWordsView(text, words);
+    return words;
+}
+
+void SplitIntoWordsView(string_view text, vector<string_view>& words) {
+    SplitIntoValidWordsView(text, words);
+}
+
+namespace {
+
+// Sets a bit for every space and for every control character among the CHUNK_SIZE bytes at data.
+#if defined(__AVX2__)
+constexpr size_t CHUNK_SIZE = 32;
+
+void ScanChunk(const char* data, uint32_t& spaces, uint32_t& controls) {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    spaces = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))));
+    controls = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(bytes, _mm256_set1_epi8(31)), bytes)));
+}
+#elif defined(__SSE2__)
+constexpr size_t CHUNK_SIZE = 16;
+
+void ScanChunk(const char* data, uint32_t& spaces, uint32_t& controls) {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    spaces = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+    // Unsigned bytes up to 31 are the ones that the minimum with 31 leaves unchanged.
+    controls = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(31)), bytes)));
+}
+#else
+constexpr size_t CHUNK_SIZE = 0;
+
+void ScanChunk(const char*, uint32_t&, uint32_t&) {
+}
+#endif
+
+bool IsControl(char c) {
+    return static_cast<unsigned char>(c) < ' ';
+}
+
+// Calls emit_word for every word, empty ones included, and returns false on a control character.
+template <typename WordEmitter>
+bool SplitValidWords(string_view text, WordEmitter emit_word) {
+    const char* const data = text.data();
+    size_t word_start = 0;
+    size_t position = 0;
+    uint32_t all_controls = 0;
+    if constexpr (CHUNK_SIZE > 0) {
+        for (; position + CHUNK_SIZE <= text.size(); position += CHUNK_SIZE) {
+            uint32_t spaces;
+            uint32_t controls;
+            ScanChunk(data + position, spaces, controls);
+            all_controls |= controls;
+            while (spaces != 0) {
+                const size_t space = position + __builtin_ctz(spaces);
+                emit_word(text.substr(word_start, space - word_start));
+                word_start = space + 1;
+                spaces &= spaces - 1;
+            }
         }
-        else {
-            text.remove_prefix(space + 1);
+    }
+    for (; position < text.size(); ++position) {
+        all_controls |= IsControl(data[position]);
+        if (data[position] == ' ') {
+            emit_word(text.substr(word_start, position - word_start));
+            word_start = position + 1;
         }
     }
-    return words;
-}
\ No newline at end of file
+    emit_word(text.substr(word_start));
+    return all_controls == 0;
+}
+
+}  // namespace
+
+bool SplitIntoValidWordsView(string_view text, vector<string_view>& words) {
+    words.clear();
+    return SplitValidWords(text, [&words](string_view word) {
+        words.push_back(word);
+    });
+}
+
+bool SplitIntoValidWordsView(string_view text, vector<string_view>& words, const StopWordSet& skipped_words) {
+    words.clear();
+    return SplitValidWords(text, [&words, &skipped_words](string_view word) {
+        if (!word.empty() && !skipped_words.Contains(word)) {
+            words.push_back(word);
+        }
+    });
+}
@@ -2,9 +2,20 @@
 #include <vector>
 #include <set>
 #include <string>
+#include <string_view>
+
+#include "stop_word_set.h"
 
 std::vector<std::string> SplitIntoWords(const std::string& text);
 std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
+// Replaces the contents of words, so that a reused vector doesn't allocate.
+void SplitIntoWordsView(std::string_view text, std::vector<std::string_view>& words);
+// Splits like SplitIntoWordsView and returns false if the text has a control character (codes 0 to 31).
+// Spaces and control characters are found in the same pass over 32 bytes at a time with AVX2,
+// 16 with SSE2, or byte by byte where neither is available.
+bool SplitIntoValidWordsView(std::string_view text, std::vector<std::string_view>& words);
+// Same, but leaves out empty words and the words of skipped_words as they are split off.
+bool SplitIntoValidWordsView(std::string_view text, std::vector<std::string_view>& words, const StopWordSet& skipped_words);
 
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
@@ -0,0 +1,131 @@
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+thread_local const TaskScheduler* current_scheduler = nullptr;
+thread_local size_t current_queue_index = 0;
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(size_t thread_count)
+        : queues_(max<size_t>(thread_count, 1)) {
+    for (size_t queue_index = 1; queue_index < queues_.size(); ++queue_index) {
+        workers_.emplace_back([this, queue_index] {
+            RunWorker(queue_index);
+        });
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        lock_guard lock(sleep_mutex_);
+        is_stopping_ = true;
+    }
+    wake_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::GetDefault() {
+    static TaskScheduler scheduler(thread::hardware_concurrency());
+    return scheduler;
+}
+
+void TaskScheduler::Spawn(TaskGroup& group, function<void()> task) {
+    group.pending_.fetch_add(1);
+    WorkerQueue& queue = queues_[GetQueueIndex()];
+    {
+        lock_guard lock(queue.mutex);
+        queue.tasks.push_back({move(task), &group});
+    }
+    queued_task_count_.fetch_add(1);
+    if (sleeping_worker_count_.load() > 0 || sleeping_waiter_count_.load() > 0) {
+        lock_guard lock(sleep_mutex_);
+        wake_.notify_one();
+        wake_waiters_.notify_all();
+    }
+}
+
+void TaskScheduler::Wait(TaskGroup& group) {
+    WaitUntil([&group] {
+        return group.pending_.load() == 0;
+    });
+    if (group.error_) {
+        rethrow_exception(exchange(group.error_, nullptr));
+    }
+}
+
+size_t TaskScheduler::GetQueueIndex() const {
+    return current_scheduler == this ? current_queue_index : 0;
+}
+
+// The own deque is used as a stack for locality; other deques are robbed from the front,
+// where the oldest and usually largest tasks are.
+bool TaskScheduler::FindTask(size_t queue_index, Task& task) {
+    if (queued_task_count_.load() == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        WorkerQueue& queue = queues_[(queue_index + i) % queues_.size()];
+        lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued_task_count_.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::RunTask(Task& task) {
+    TaskGroup& group = *task.group;
+    try {
+        task.function();
+    } catch (...) {
+        lock_guard lock(group.error_mutex_);
+        if (!group.error_) {
+            group.error_ = current_exception();
+        }
+    }
+    task.function = nullptr;
+    group.pending_.fetch_sub(1);
+    // The group may be gone once its counter drops: only the scheduler is touched from here.
+    if (sleeping_waiter_count_.load() > 0) {
+        lock_guard lock(sleep_mutex_);
+        wake_waiters_.notify_all();
+    }
+}
+
+void TaskScheduler::RunWorker(size_t queue_index) {
+    current_scheduler = this;
+    current_queue_index = queue_index;
+    Task task;
+    while (true) {
+        if (FindTask(queue_index, task)) {
+            RunTask(task);
+            continue;
+        }
+        unique_lock lock(sleep_mutex_);
+        sleeping_worker_count_.fetch_add(1);
+        wake_.wait(lock, [this] {
+            return is_stopping_ || queued_task_count_.load() > 0;
+        });
+        sleeping_worker_count_.fetch_sub(1);
+        if (is_stopping_) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks spawned into a TaskGroup are waited for together.
+class TaskGroup {
+private:
+    friend class TaskScheduler;
+
+    std::atomic<size_t> pending_ = 0;
+    std::mutex error_mutex_;
+    // The first exception thrown by a task, rethrown by Wait.
+    std::exception_ptr error_;
+};
+
+// Work-stealing thread pool. Every worker has its own deque: it runs its newest task first and,
+// when the deque is empty, steals the oldest task of another worker. A thread waiting for
+// a group runs tasks too, so tasks may spawn and wait for subtasks without blocking a worker.
+// Threads outside the pool share deque 0.
+class TaskScheduler {
+public:
+    // The calling thread of Wait works alongside thread_count - 1 pool threads.
+    explicit TaskScheduler(size_t thread_count);
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+    ~TaskScheduler();
+
+    // Scheduler with a thread per core for the functions that don't take one.
+    static TaskScheduler& GetDefault();
+
+    size_t GetThreadCount() const {
+        return queues_.size();
+    }
+
+    void Spawn(TaskGroup& group, std::function<void()> task);
+    // Returns when every task of the group has finished, rethrowing the first exception of them.
+    void Wait(TaskGroup& group);
+    // Runs queued tasks until is_done() returns true, for a thread waiting on something other than
+    // a group. With nothing to run, the thread spins for a while and then sleeps until a task is
+    // spawned or finishes, so is_done has to become true only in a task of this scheduler.
+    template <typename Predicate>
+    void WaitUntil(Predicate is_done);
+
+    // Calls function(i) for every i in [0, count) as separate tasks.
+    template <typename Function>
+    void ParallelFor(size_t count, Function function);
+
+private:
+    struct Task {
+        std::function<void()> function;
+        TaskGroup* group;
+    };
+
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Rounds of yielding before a waiting thread with nothing to run goes to sleep.
+    static constexpr size_t WAIT_SPIN_COUNT = 64;
+
+    size_t GetQueueIndex() const;
+    bool FindTask(size_t queue_index, Task& task);
+    void RunTask(Task& task);
+    void RunWorker(size_t queue_index);
+
+    std::vector<WorkerQueue> queues_;
+    std::atomic<size_t> queued_task_count_ = 0;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> sleeping_worker_count_ = 0;
+    bool is_stopping_ = false;
+    // Waiting threads sleep apart from the workers: they are woken when a task finishes, too.
+    std::condition_variable wake_waiters_;
+    std::atomic<size_t> sleeping_waiter_count_ = 0;
+
+    std::vector<std::thread> workers_;
+};
+
+template <typename Function>
+void TaskScheduler::ParallelFor(size_t count, Function function) {
+    TaskGroup group;
+    for (size_t i = 0; i < count; ++i) {
+        Spawn(group, [&function, i] {
+            function(i);
+        });
+    }
+    Wait(group);
+}
+
+template <typename Predicate>
+void TaskScheduler::WaitUntil(Predicate is_done) {
+    const size_t queue_index = GetQueueIndex();
+    Task task;
+    size_t spin_count = 0;
+    while (!is_done()) {
+        if (FindTask(queue_index, task)) {
+            RunTask(task);
+            spin_count = 0;
+        } else if (spin_count < WAIT_SPIN_COUNT) {
+            ++spin_count;
+            std::this_thread::yield();
+        } else {
+            std::unique_lock lock(sleep_mutex_);
+            sleeping_waiter_count_.fetch_add(1);
+            wake_waiters_.wait(lock, [this, &is_done] {
+                return queued_task_count_.load() > 0 || is_done();
+            });
+            sleeping_waiter_count_.fetch_sub(1);
+            spin_count = 0;
+        }
+    }
+}
+
+namespace scheduling {
+
+// Execution strategy for FindTopDocuments next to std::execution::seq/par.
+// The query runs as a task of the scheduler; when its words have more than min_chunk_postings
+// postings, it is split into ordinal ranges scored by parallel subtasks, which idle workers steal
+// from between the tasks of lighter queries.
+struct task_policy {
+    TaskScheduler* scheduler = nullptr;
+    size_t min_chunk_postings = 16384;
+};
+
+} // namespace scheduling
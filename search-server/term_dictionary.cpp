@@ -0,0 +1,87 @@
+#include "term_dictionary.h"
+
+#include <functional>
+
+using namespace std;
+
+optional<uint32_t> TermDictionary::Find(string_view word) const {
+    if (slots_.empty()) {
+        return nullopt;
+    }
+    const uint32_t term = slots_[FindSlot(word, hash<string_view>{}(word))];
+    if (term == EMPTY_SLOT) {
+        return nullopt;
+    }
+    return term;
+}
+
+uint32_t TermDictionary::Insert(string_view word) {
+    // Keeps the table at most half full, so probe sequences stay short.
+    if (2 * (size() + 1) > slots_.size()) {
+        Rehash(slots_.empty() ? 16 : 2 * slots_.size());
+    }
+    const size_t word_hash = hash<string_view>{}(word);
+    const size_t slot = FindSlot(word, word_hash);
+    if (slots_[slot] != EMPTY_SLOT) {
+        return slots_[slot];
+    }
+    uint32_t term;
+    if (free_terms_.empty()) {
+        term = static_cast<uint32_t>(words_.size());
+        words_.push_back(word);
+        hashes_.push_back(word_hash);
+    } else {
+        term = free_terms_.back();
+        free_terms_.pop_back();
+        words_[term] = word;
+        hashes_[term] = word_hash;
+    }
+    slots_[slot] = term;
+    return term;
+}
+
+// Backward-shift deletion: entries of the probe run after the hole move into it unless that
+// would put them before their home slot, so lookups never need tombstones.
+void TermDictionary::Erase(uint32_t term) {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = FindSlot(words_[term], hashes_[term]);
+    for (size_t next = (slot + 1) & mask; slots_[next] != EMPTY_SLOT; next = (next + 1) & mask) {
+        const size_t home = hashes_[slots_[next]] & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            slots_[slot] = slots_[next];
+            slot = next;
+        }
+    }
+    slots_[slot] = EMPTY_SLOT;
+    words_[term] = {};
+    free_terms_.push_back(term);
+}
+
+size_t TermDictionary::size() const {
+    return words_.size() - free_terms_.size();
+}
+
+size_t TermDictionary::FindSlot(string_view word, size_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = hash & mask;
+    while (slots_[slot] != EMPTY_SLOT && (hashes_[slots_[slot]] != hash || words_[slots_[slot]] != word)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void TermDictionary::Rehash(size_t slot_count) {
+    vector<uint32_t> old_slots(slot_count, EMPTY_SLOT);
+    slots_.swap(old_slots);
+    const size_t mask = slot_count - 1;
+    for (const uint32_t term : old_slots) {
+        if (term == EMPTY_SLOT) {
+            continue;
+        }
+        size_t slot = hashes_[term] & mask;
+        while (slots_[slot] != EMPTY_SLOT) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = term;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Assigns dense 32-bit ids to words in order of insertion; ids of erased words are reused first.
+// Lookup is an open-addressing table with linear probing over the ids; every id keeps
+// the hash of its word, so probing compares strings only on a full hash match.
+// The dictionary doesn't own the words: they must outlive it.
+class TermDictionary {
+public:
+    std::optional<uint32_t> Find(std::string_view word) const;
+    // Returns the id of the word, adding it if it is new.
+    uint32_t Insert(std::string_view word);
+    void Erase(uint32_t term);
+
+    std::string_view GetWord(uint32_t term) const {
+        return words_[term];
+    }
+
+    // Number of words in the dictionary; ids may go up to the number of words ever held at once.
+    size_t size() const;
+
+private:
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    size_t FindSlot(std::string_view word, size_t hash) const;
+    void Rehash(size_t slot_count);
+
+    std::vector<std::string_view> words_;
+    std::vector<size_t> hashes_;
+    std::vector<uint32_t> slots_;
+    std::vector<uint32_t> free_terms_;
+};
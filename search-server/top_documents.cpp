@@ -0,0 +1,40 @@
+#include "top_documents.h"
+
+#include <algorithm>
+
+using namespace std;
+
+TopDocuments::TopDocuments(size_t max_count)
+        : max_count_(max_count) {
+    heap_.reserve(max_count);
+}
+
+void TopDocuments::Push(const Document& document) {
+    if (heap_.size() < max_count_) {
+        heap_.push_back(document);
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    } else if (max_count_ > 0 && IsMoreRelevant(document, heap_.front())) {
+        pop_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        heap_.back() = document;
+        push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    }
+}
+
+void TopDocuments::Merge(const TopDocuments& other) {
+    for (const Document& document : other.heap_) {
+        Push(document);
+    }
+}
+
+bool TopDocuments::IsFull() const {
+    return heap_.size() >= max_count_;
+}
+
+const Document& TopDocuments::GetWorst() const {
+    return heap_.front();
+}
+
+vector<Document> TopDocuments::Extract() {
+    sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+    return move(heap_);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "document.h"
+
+// Selects the max_count most relevant documents out of a stream in O(n log max_count).
+// The kept documents form a heap with the least relevant one on top, so a candidate
+// is compared against a single element before it is dropped.
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t max_count);
+
+    void Push(const Document& document);
+    void Merge(const TopDocuments& other);
+
+    bool IsFull() const;
+    // The document a candidate has to outrank; valid only when IsFull().
+    const Document& GetWorst() const;
+
+    // Returns the kept documents ordered from the most relevant one.
+    std::vector<Document> Extract();
+
+private:
+    size_t max_count_;
+    std::vector<Document> heap_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// 128-bit hash of a set of words or of term ids, built from two independent 64-bit hashes
+// of every element. Elements must be added in ascending order without repeats, so that equal
+// sets get equal fingerprints; different sets collide with a probability of about 2^-128.
+class WordSetFingerprint {
+public:
+    struct Hasher {
+        size_t operator()(const WordSetFingerprint& fingerprint) const {
+            return static_cast<size_t>(fingerprint.low_);
+        }
+    };
+
+    // Finalizer of splitmix64.
+    static uint64_t Mix(uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xBF58476D1CE4E5B9ull;
+        value ^= value >> 27;
+        value *= 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+    void Add(std::string_view word) {
+        uint64_t fnv_hash = 0xCBF29CE484222325ull;
+        for (const char c : word) {
+            fnv_hash = (fnv_hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+        }
+        low_ = Mix(low_ ^ std::hash<std::string_view>()(word));
+        high_ = Mix(high_ + fnv_hash);
+    }
+
+    void Add(uint32_t term) {
+        low_ = Mix(low_ ^ term);
+        high_ = Mix(high_ + term * 0x9E3779B97F4A7C15ull);
+    }
+
+    bool operator==(const WordSetFingerprint& other) const {
+        return low_ == other.low_ && high_ == other.high_;
+    }
+
+    bool operator<(const WordSetFingerprint& other) const {
+        return low_ < other.low_ || (low_ == other.low_ && high_ < other.high_);
+    }
+
+private:
+    uint64_t low_ = 0x9E3779B97F4A7C15ull;
+    uint64_t high_ = 0;
+};